@@ -0,0 +1,463 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-anim.h"
+#include "image-ops.h"
+
+#define ANIM_RING 8
+#define ANIM_MIN_DELAY 20
+#define ANIM_KEEP_BYTES ( 64 << 20 )
+
+typedef struct _AnimFrame AnimFrame;
+
+struct _AnimFrame
+{
+	cairo_surface_t *surface;
+
+	int delay;
+};
+
+typedef struct _AnimKeep AnimKeep;
+
+struct _AnimKeep
+{
+	uint64_t hash;
+
+	cairo_surface_t *surface;
+};
+
+typedef struct _AnimJob AnimJob;
+
+struct _AnimJob
+{
+	char *path;
+
+	int width;
+	int height;
+
+	ImageLoad load;
+
+	uint serial;
+	GCancellable *cancel;
+
+	ImageAnim *anim;
+};
+
+/* The worker scales and converts each distinct frame once into a ring of surfaces and waits while the ring is full;
+   the view's frame clock takes them out at their deadlines. A hidden window stops the clock, and so the worker. */
+struct _ImageAnim
+{
+	GMutex lock;
+	GCond  cond;
+
+	GThreadPool *pool;
+	GCancellable *cancel;
+
+	AnimFrame ring[ANIM_RING];
+	uint8_t head;
+	uint8_t count;
+
+	GdkPixbuf *first;
+	ImageLoad load;
+	uint src_first;
+
+	gboolean posted;
+	gboolean play;
+
+	uint serial;
+
+	ImageView *view;
+	uint tick;
+	int64_t deadline;
+
+	uint frames;
+	uint late;
+
+	AnimFunc func;
+	gpointer data;
+};
+
+static void image_anim_job_free ( AnimJob *job )
+{
+	g_object_unref ( job->cancel );
+
+	free ( job->path );
+	free ( job );
+}
+
+/* Lock held */
+static void image_anim_ring_clear ( ImageAnim *anim )
+{
+	while ( anim->count )
+	{
+		cairo_surface_destroy ( anim->ring[anim->head].surface );
+
+		anim->head = ( anim->head + 1 ) % ANIM_RING;
+		anim->count--;
+	}
+
+	anim->head = 0;
+}
+
+static gboolean image_anim_tick ( G_GNUC_UNUSED GtkWidget *widget, GdkFrameClock *clock, ImageAnim *anim )
+{
+	int64_t now = gdk_frame_clock_get_frame_time ( clock );
+
+	if ( now < anim->deadline ) return G_SOURCE_CONTINUE;
+
+	AnimFrame frame = { NULL, 0 };
+
+	g_mutex_lock ( &anim->lock );
+
+	if ( anim->count )
+	{
+		frame = anim->ring[anim->head];
+
+		anim->head = ( anim->head + 1 ) % ANIM_RING;
+		anim->count--;
+
+		g_cond_signal ( &anim->cond );
+	}
+
+	g_mutex_unlock ( &anim->lock );
+
+	/* The worker is behind; the frame stays due */
+	if ( !frame.surface ) { if ( anim->deadline ) anim->late++; return G_SOURCE_CONTINUE; }
+
+	image_view_set_frame ( anim->view, frame.surface );
+
+	cairo_surface_destroy ( frame.surface );
+
+	anim->frames++;
+
+	if ( frame.delay < 0 ) { anim->tick = 0; return G_SOURCE_REMOVE; }
+
+	/* Deadlines advance by the frame delay, so the clock never drifts; more than a frame behind starts over from now */
+	anim->deadline = ( anim->deadline && now - anim->deadline < frame.delay * 1000 ) ? anim->deadline + frame.delay * 1000 : now + frame.delay * 1000;
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* The first frame goes out as a pixbuf: the window shows it like any decode, then the clock starts */
+static gboolean image_anim_first ( ImageAnim *anim )
+{
+	g_mutex_lock ( &anim->lock );
+
+	GdkPixbuf *pixbuf = anim->first;
+	ImageLoad load = anim->load;
+
+	gboolean posted = anim->posted;
+	gboolean play = anim->play;
+
+	anim->first = NULL;
+	anim->posted = FALSE;
+	anim->src_first = 0;
+
+	g_mutex_unlock ( &anim->lock );
+
+	if ( !posted ) return FALSE;
+
+	anim->func ( pixbuf, &load, anim->data );
+
+	if ( pixbuf && play && !anim->tick )
+	{
+		anim->deadline = 0;
+
+		anim->tick = gtk_widget_add_tick_callback ( GTK_WIDGET ( anim->view ), (GtkTickCallback)image_anim_tick, anim, NULL );
+	}
+
+	if ( pixbuf ) g_object_unref ( pixbuf );
+
+	return FALSE;
+}
+
+static void image_anim_post_first ( AnimJob *job, GdkPixbuf *pixbuf, gboolean play )
+{
+	ImageAnim *anim = job->anim;
+
+	g_mutex_lock ( &anim->lock );
+
+	if ( job->serial == anim->serial && !g_cancellable_is_cancelled ( job->cancel ) )
+	{
+		if ( anim->first ) g_object_unref ( anim->first );
+
+		anim->first  = pixbuf;
+		anim->load   = job->load;
+		anim->play   = play;
+		anim->posted = TRUE;
+
+		pixbuf = NULL;
+
+		if ( !anim->src_first ) anim->src_first = g_idle_add ( (GSourceFunc)image_anim_first, anim );
+	}
+
+	g_mutex_unlock ( &anim->lock );
+
+	if ( pixbuf ) g_object_unref ( pixbuf );
+}
+
+/* Waits for room in the ring; FALSE once the job is cancelled */
+static gboolean image_anim_push ( AnimJob *job, cairo_surface_t *surface, int delay )
+{
+	ImageAnim *anim = job->anim;
+
+	g_mutex_lock ( &anim->lock );
+
+	while ( anim->count == ANIM_RING && !g_cancellable_is_cancelled ( job->cancel ) ) g_cond_wait ( &anim->cond, &anim->lock );
+
+	gboolean run = !g_cancellable_is_cancelled ( job->cancel );
+
+	if ( run )
+	{
+		anim->ring[( anim->head + anim->count ) % ANIM_RING] = (AnimFrame){ surface, delay };
+		anim->count++;
+	}
+
+	g_mutex_unlock ( &anim->lock );
+
+	if ( !run ) cairo_surface_destroy ( surface );
+
+	return run;
+}
+
+static void image_anim_keep_free ( AnimKeep *keep )
+{
+	cairo_surface_destroy ( keep->surface );
+
+	free ( keep );
+}
+
+/* Identifies a composited frame, so a later loop finds the surface made for it in the first */
+static uint64_t image_anim_hash ( GdkPixbuf *pixbuf )
+{
+	int h = gdk_pixbuf_get_height ( pixbuf );
+	int stride = gdk_pixbuf_get_rowstride ( pixbuf );
+	int row = gdk_pixbuf_get_width ( pixbuf ) * gdk_pixbuf_get_n_channels ( pixbuf );
+
+	const uint8_t *pixels = gdk_pixbuf_read_pixels ( pixbuf );
+
+	uint64_t hash = 14695981039346656037u;
+
+	int y = 0; for ( y = 0; y < h; y++ )
+	{
+		const uint8_t *p = pixels + (size_t)y * (size_t)stride;
+
+		uint64_t w = 0;
+
+		int c = 0; for ( c = 0; c + 8 <= row; c += 8 )
+		{
+			memcpy ( &w, p + c, 8 );
+
+			hash = ( hash ^ w ) * 0x9e3779b97f4a7c15u;
+			hash ^= hash >> 29;
+		}
+
+		for ( ; c < row; c++ ) hash = ( hash ^ p[c] ) * 0x100000001b3u;
+	}
+
+	return hash;
+}
+
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+
+static void image_anim_thread ( AnimJob *job, G_GNUC_UNUSED ImageAnim *anim )
+{
+	GError *error = NULL;
+	GdkPixbufAnimation *animation = ( g_cancellable_is_cancelled ( job->cancel ) ) ? NULL : image_load_animation ( job->path, &job->load, &error );
+
+	if ( !animation )
+	{
+		if ( error ) g_warning ( "%s:: %s ", __func__, error->message );
+
+		if ( error ) g_error_free ( error );
+
+		image_anim_post_first ( job, NULL, FALSE );
+		image_anim_job_free ( job );
+
+		return;
+	}
+
+	int org_w = gdk_pixbuf_animation_get_width  ( animation );
+	int org_h = gdk_pixbuf_animation_get_height ( animation );
+
+	double scale = ( job->width > 0 && job->height > 0 ) ? MIN ( 1.0, MIN ( (double)job->width / org_w, (double)job->height / org_h ) ) : 1.0;
+
+	int set_w = MAX ( 1, (int)( org_w * scale + 0.5 ) );
+	int set_h = MAX ( 1, (int)( org_h * scale + 0.5 ) );
+
+	gboolean play = !gdk_pixbuf_animation_is_static_image ( animation );
+
+	GTimeVal time = { 0, 0 };
+	GdkPixbufAnimationIter *iter = gdk_pixbuf_animation_get_iter ( animation, &time );
+
+	/* Surfaces of the first loop, by frame content, while they fit ANIM_KEEP_BYTES; later loops replay them */
+	GHashTable *keep = g_hash_table_new_full ( g_int64_hash, g_int64_equal, NULL, (GDestroyNotify)image_anim_keep_free );
+
+	size_t keep_bytes = 0;
+	uint replays = 0;
+
+	uint n = 0; for ( n = 0; !g_cancellable_is_cancelled ( job->cancel ); n++ )
+	{
+		int delay = ( play ) ? gdk_pixbuf_animation_iter_get_delay_time ( iter ) : -1;
+
+		delay = ( delay < 0 ) ? -1 : MAX ( delay, ANIM_MIN_DELAY );
+
+		/* The iterator composites into a pixbuf it reuses; the scale makes the copy */
+		GdkPixbuf *pixbuf = gdk_pixbuf_animation_iter_get_pixbuf ( iter );
+
+		uint64_t hash = ( play ) ? image_anim_hash ( pixbuf ) : 0;
+
+		AnimKeep *kept = ( play ) ? g_hash_table_lookup ( keep, &hash ) : NULL;
+
+		cairo_surface_t *surface = NULL;
+
+		if ( kept )
+		{
+			surface = cairo_surface_reference ( kept->surface );
+
+			replays++;
+		}
+		else
+		{
+			GdkPixbuf *frame = ( set_w == org_w && set_h == org_h ) ? gdk_pixbuf_copy ( pixbuf ) : image_ops_scale ( pixbuf, set_w, set_h, OPS_BILINEAR );
+
+			if ( !frame ) break;
+
+			if ( n == 0 ) image_anim_post_first ( job, g_object_ref ( frame ), play );
+
+			if ( !play ) { g_object_unref ( frame ); break; }
+
+			surface = image_ops_surface ( frame );
+
+			g_object_unref ( frame );
+
+			size_t bytes = ( surface ) ? (size_t)cairo_image_surface_get_stride ( surface ) * (size_t)cairo_image_surface_get_height ( surface ) : 0;
+
+			if ( surface && keep_bytes + bytes <= ANIM_KEEP_BYTES )
+			{
+				kept = g_new0 ( AnimKeep, 1 );
+
+				kept->hash    = hash;
+				kept->surface = cairo_surface_reference ( surface );
+
+				g_hash_table_insert ( keep, &kept->hash, kept );
+
+				keep_bytes += bytes;
+			}
+		}
+
+		if ( !surface || !image_anim_push ( job, surface, delay ) || delay < 0 ) break;
+
+		g_time_val_add ( &time, delay * 1000 );
+
+		gdk_pixbuf_animation_iter_advance ( iter, &time );
+	}
+
+	if ( play ) g_debug ( "%s:: %u frames, %u replayed, %u kept, %.1f MiB", __func__, n, replays, g_hash_table_size ( keep ), (double)keep_bytes / ( 1 << 20 ) );
+
+	g_hash_table_unref ( keep );
+
+	g_object_unref ( iter );
+	g_object_unref ( animation );
+
+	image_anim_job_free ( job );
+}
+
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+/* load comes from the probe; width / height <= 0 means original size */
+void image_anim_open ( ImageAnim *anim, const char *path, int width, int height, ImageLoad *load )
+{
+	image_anim_stop ( anim );
+
+	AnimJob *job = g_new0 ( AnimJob, 1 );
+
+	job->path   = g_strdup ( path );
+	job->width  = width;
+	job->height = height;
+	job->load   = *load;
+	job->anim   = anim;
+	job->serial = anim->serial;
+	job->cancel = g_object_ref ( anim->cancel );
+
+	g_thread_pool_push ( anim->pool, job, NULL );
+}
+
+void image_anim_stop ( ImageAnim *anim )
+{
+	if ( anim->frames ) g_debug ( "%s:: %u frames, %u late ticks", __func__, anim->frames, anim->late );
+
+	if ( anim->tick ) gtk_widget_remove_tick_callback ( GTK_WIDGET ( anim->view ), anim->tick );
+
+	anim->tick   = 0;
+	anim->frames = 0;
+	anim->late   = 0;
+
+	g_cancellable_cancel ( anim->cancel );
+	g_object_unref ( anim->cancel );
+
+	anim->cancel = g_cancellable_new ();
+
+	g_mutex_lock ( &anim->lock );
+
+	anim->serial++;
+
+	image_anim_ring_clear ( anim );
+
+	if ( anim->first ) g_object_unref ( anim->first );
+
+	anim->first  = NULL;
+	anim->posted = FALSE;
+
+	g_cond_broadcast ( &anim->cond );
+
+	g_mutex_unlock ( &anim->lock );
+}
+
+void image_anim_free ( ImageAnim *anim )
+{
+	image_anim_stop ( anim );
+
+	g_thread_pool_free ( anim->pool, FALSE, TRUE );
+
+	if ( anim->src_first ) g_source_remove ( anim->src_first );
+
+	if ( anim->first ) g_object_unref ( anim->first );
+
+	g_mutex_lock ( &anim->lock );
+
+	image_anim_ring_clear ( anim );
+
+	g_mutex_unlock ( &anim->lock );
+
+	g_object_unref ( anim->cancel );
+
+	g_mutex_clear ( &anim->lock );
+	g_cond_clear  ( &anim->cond );
+
+	free ( anim );
+}
+
+ImageAnim * image_anim_new ( ImageView *view, AnimFunc func, gpointer data )
+{
+	ImageAnim *anim = g_new0 ( ImageAnim, 1 );
+
+	g_mutex_init ( &anim->lock );
+	g_cond_init  ( &anim->cond );
+
+	anim->view = view;
+	anim->func = func;
+	anim->data = data;
+
+	anim->cancel = g_cancellable_new ();
+
+	anim->pool = g_thread_pool_new ( (GFunc)image_anim_thread, anim, 1, FALSE, NULL );
+
+	return anim;
+}
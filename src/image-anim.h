@@ -0,0 +1,25 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include "image-load.h"
+#include "image-view.h"
+
+typedef struct _ImageAnim ImageAnim;
+
+typedef void ( *AnimFunc ) ( GdkPixbuf *, ImageLoad *, gpointer );
+
+ImageAnim * image_anim_new ( ImageView *, AnimFunc, gpointer );
+
+void image_anim_free ( ImageAnim * );
+
+void image_anim_open ( ImageAnim *, const char *, int, int, ImageLoad * );
+
+void image_anim_stop ( ImageAnim * );
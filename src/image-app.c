@@ -9,10 +9,16 @@
 
 #include "image-app.h"
 #include "image-win.h"
+#include "image-thumb-cache.h"
+
+#define CACHE_BYTES ( 256 * 1024 * 1024 )
 
 struct _ImageApp
 {
 	GtkApplication  parent_instance;
+
+	ImageCache *cache;
+	ImageThumbPool *thumb_pool;
 };
 
 G_DEFINE_TYPE ( ImageApp, image_app, GTK_TYPE_APPLICATION )
@@ -27,13 +33,43 @@ static void image_app_activate ( GApplication *app )
 	image_win_new ( NULL, IMAGE_APP ( app ) );
 }
 
-static void image_app_init ( G_GNUC_UNUSED ImageApp *app )
+/* Decoded images, shared by all windows */
+ImageCache * image_app_get_cache ( ImageApp *app )
+{
+	return app->cache;
+}
+
+/* Thumbnail workers, shared by all windows */
+ImageThumbPool * image_app_get_thumb_pool ( ImageApp *app )
 {
+	return app->thumb_pool;
+}
 
+/* Worker: no metadata calls, mtime and size were enumerated with the directory */
+static void image_app_thumb_run ( ThumbJob *job, G_GNUC_UNUSED gpointer data )
+{
+	job->pixbuf = image_thumb_cache_get ( job->path, job->mtime, job->file_size, job->size );
+}
+
+/* IMAGE_CACHE_MB overrides the budget */
+static void image_app_init ( ImageApp *app )
+{
+	const char *env = g_getenv ( "IMAGE_CACHE_MB" );
+
+	uint64_t bytes = ( env ) ? g_ascii_strtoull ( env, NULL, 10 ) * 1024 * 1024 : CACHE_BYTES;
+
+	app->cache = image_cache_new ( bytes );
+
+	app->thumb_pool = image_thumb_pool_new ( (ThumbFunc)image_app_thumb_run, NULL );
 }
 
 static void image_app_finalize ( GObject *object )
 {
+	ImageApp *app = IMAGE_APP ( object );
+
+	image_thumb_pool_free ( app->thumb_pool );
+	image_cache_free ( app->cache );
+
 	G_OBJECT_CLASS ( image_app_parent_class )->finalize ( object );
 }
 
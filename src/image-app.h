@@ -9,7 +9,8 @@
 
 #pragma once
 
-#include <gtk/gtk.h>
+#include "image-cache.h"
+#include "image-thumb.h"
 
 #define IMAGE_TYPE_APP image_app_get_type ()
 
@@ -17,3 +18,6 @@ G_DECLARE_FINAL_TYPE ( ImageApp, image_app, IMAGE, APP, GtkApplication )
 
 ImageApp * image_app_new ( void );
 
+ImageCache * image_app_get_cache ( ImageApp * );
+
+ImageThumbPool * image_app_get_thumb_pool ( ImageApp * );
@@ -0,0 +1,173 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-cache.h"
+
+typedef struct _CacheEntry CacheEntry;
+
+struct _CacheEntry
+{
+	char *key;
+
+	GdkPixbuf *pixbuf;
+	ImageLoad load;
+
+	uint64_t bytes;
+};
+
+/* Decoded pixbufs of all windows, most recently used at the head of the queue.
+   Pixels are kept as decoded; orientation is applied by the view at draw time. */
+struct _ImageCache
+{
+	GQueue lru;
+	GHashTable *entries;
+
+	uint64_t bytes;
+	uint64_t max_bytes;
+
+	uint hits;
+	uint misses;
+	uint evicts;
+};
+
+static void image_cache_entry_free ( CacheEntry *entry )
+{
+	g_object_unref ( entry->pixbuf );
+
+	free ( entry->key );
+	free ( entry );
+}
+
+/* The target box is part of the key: a fit decode and an original decode are different pixbufs */
+static char * image_cache_key ( const char *path, int width, int height )
+{
+	return g_strdup_printf ( "%d:%d:%s", MAX ( width, 0 ), MAX ( height, 0 ), path );
+}
+
+static void image_cache_remove ( GList *link, ImageCache *cache )
+{
+	CacheEntry *entry = link->data;
+
+	g_queue_delete_link ( &cache->lru, link );
+	g_hash_table_remove ( cache->entries, entry->key );
+
+	cache->bytes -= entry->bytes;
+
+	image_cache_entry_free ( entry );
+}
+
+static void image_cache_evict ( uint64_t need, ImageCache *cache )
+{
+	while ( cache->lru.tail && cache->bytes + need > cache->max_bytes )
+	{
+		image_cache_remove ( cache->lru.tail, cache );
+
+		cache->evicts++;
+	}
+}
+
+/* load->mtime has to be set: an entry of an older version of the file is dropped */
+GdkPixbuf * image_cache_lookup ( ImageCache *cache, const char *path, int width, int height, ImageLoad *load )
+{
+	g_autofree char *key = image_cache_key ( path, width, height );
+
+	GList *link = g_hash_table_lookup ( cache->entries, key );
+
+	CacheEntry *entry = ( link ) ? link->data : NULL;
+
+	if ( entry && ( entry->load.mtime != load->mtime || entry->load.size != load->size ) )
+	{
+		image_cache_remove ( link, cache );
+
+		entry = NULL;
+	}
+
+	g_debug ( "%s:: %s :: %s", __func__, ( entry ) ? "hit" : "miss", path );
+
+	if ( !entry ) { cache->misses++; return NULL; }
+
+	g_queue_unlink ( &cache->lru, link );
+	g_queue_push_head_link ( &cache->lru, link );
+
+	cache->hits++;
+
+	*load = entry->load;
+
+	return g_object_ref ( entry->pixbuf );
+}
+
+/* No stat: a stale entry only costs a skipped prefetch, the lookup still checks mtime */
+gboolean image_cache_contains ( ImageCache *cache, const char *path, int width, int height )
+{
+	g_autofree char *key = image_cache_key ( path, width, height );
+
+	return g_hash_table_contains ( cache->entries, key );
+}
+
+void image_cache_insert ( ImageCache *cache, const char *path, int width, int height, GdkPixbuf *pixbuf, ImageLoad *load )
+{
+	uint64_t bytes = gdk_pixbuf_get_byte_length ( pixbuf );
+
+	g_autofree char *key = image_cache_key ( path, width, height );
+
+	GList *link = g_hash_table_lookup ( cache->entries, key );
+
+	if ( link ) image_cache_remove ( link, cache );
+
+	if ( bytes > cache->max_bytes / 2 ) return;
+
+	image_cache_evict ( bytes, cache );
+
+	CacheEntry *entry = g_new0 ( CacheEntry, 1 );
+	entry->key    = g_strdup ( key );
+	entry->pixbuf = g_object_ref ( pixbuf );
+	entry->load   = *load;
+	entry->bytes  = bytes;
+
+	entry->load.decodes  = 0;
+	entry->load.t_probe  = 0;
+	entry->load.t_decode = 0;
+
+	g_queue_push_head ( &cache->lru, entry );
+	g_hash_table_insert ( cache->entries, entry->key, cache->lru.head );
+
+	cache->bytes += bytes;
+}
+
+/* Running totals: logged with each load and again at exit */
+void image_cache_stats_dump ( ImageCache *cache )
+{
+	uint n = cache->hits + cache->misses;
+
+	g_debug ( "%s:: %u entries, %.1f / %.1f MiB, hits %u, misses %u ( %.0f%% hits ), evicts %u", __func__, cache->lru.length, 
+		(double)cache->bytes / ( 1 << 20 ), (double)cache->max_bytes / ( 1 << 20 ), cache->hits, cache->misses, ( n ) ? cache->hits * 100.0 / n : 0, cache->evicts );
+}
+
+void image_cache_free ( ImageCache *cache )
+{
+	image_cache_stats_dump ( cache );
+
+	while ( cache->lru.head ) image_cache_remove ( cache->lru.head, cache );
+
+	g_hash_table_unref ( cache->entries );
+
+	free ( cache );
+}
+
+ImageCache * image_cache_new ( uint64_t max_bytes )
+{
+	ImageCache *cache = g_new0 ( ImageCache, 1 );
+
+	g_queue_init ( &cache->lru );
+
+	cache->max_bytes = max_bytes;
+	cache->entries = g_hash_table_new ( g_str_hash, g_str_equal );
+
+	return cache;
+}
@@ -0,0 +1,26 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include "image-load.h"
+
+typedef struct _ImageCache ImageCache;
+
+ImageCache * image_cache_new ( uint64_t );
+
+void image_cache_free ( ImageCache * );
+
+GdkPixbuf * image_cache_lookup ( ImageCache *, const char *, int, int, ImageLoad * );
+
+gboolean image_cache_contains ( ImageCache *, const char *, int, int );
+
+void image_cache_insert ( ImageCache *, const char *, int, int, GdkPixbuf *, ImageLoad * );
+
+void image_cache_stats_dump ( ImageCache * );
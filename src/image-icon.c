@@ -0,0 +1,170 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-icon.h"
+
+/* Loaded icons keyed by "<icon names>|<size>|<state>"; misses are cached as NULL */
+
+enum icon_state_enm
+{
+	ICON_REGULAR,
+	ICON_LINK,
+	ICON_LINK_BROKEN,
+	ICON_NAME_REGULAR,
+	ICON_NAME_FORCE
+};
+
+static GHashTable *icon_cache = NULL;
+
+static uint icon_hits = 0, icon_loads = 0;
+
+static void image_icon_theme_changed ( G_GNUC_UNUSED GtkIconTheme *icon_theme, G_GNUC_UNUSED gpointer data )
+{
+	g_hash_table_remove_all ( icon_cache );
+
+	g_debug ( "%s:: icon cache cleared", __func__ );
+}
+
+static void image_icon_unref ( GdkPixbuf *pixbuf )
+{
+	if ( pixbuf ) g_object_unref ( pixbuf );
+}
+
+static GHashTable * image_icon_cache ( void )
+{
+	if ( icon_cache ) return icon_cache;
+
+	icon_cache = g_hash_table_new_full ( g_str_hash, g_str_equal, free, (GDestroyNotify)image_icon_unref );
+
+	g_signal_connect ( gtk_icon_theme_get_default (), "changed", G_CALLBACK ( image_icon_theme_changed ), NULL );
+
+	return icon_cache;
+}
+
+static GdkPixbuf * image_icon_cache_find ( const char *key, gboolean *found )
+{
+	gpointer pixbuf = NULL;
+
+	*found = g_hash_table_lookup_extended ( image_icon_cache (), key, NULL, &pixbuf );
+
+	if ( *found ) icon_hits++;
+
+	return ( pixbuf ) ? g_object_ref ( pixbuf ) : NULL;
+}
+
+static GdkPixbuf * image_icon_cache_add ( char *key, GdkPixbuf *pixbuf )
+{
+	icon_loads++;
+
+	g_hash_table_insert ( image_icon_cache (), key, ( pixbuf ) ? g_object_ref ( pixbuf ) : NULL );
+
+	return pixbuf;
+}
+
+static GIcon * image_icon_emblemed ( const char *name_1, const char *name_2, GIcon *gicon )
+{
+	GIcon *e_icon = g_themed_icon_new ( name_1 );
+	GEmblem *emblem  = g_emblem_new ( e_icon );
+
+	GIcon *emblemed  = g_emblemed_icon_new ( gicon, emblem );
+
+	if ( name_2 )
+	{
+		GIcon *e_icon_2 = g_themed_icon_new ( name_2 );
+		GEmblem *emblem_2  = g_emblem_new ( e_icon_2 );
+
+		g_emblemed_icon_add_emblem ( G_EMBLEMED_ICON ( emblemed ), emblem_2 );
+
+		g_object_unref ( e_icon_2 );
+		g_object_unref ( emblem_2 );
+	}
+
+	g_object_unref ( e_icon );
+	g_object_unref ( emblem );
+
+	return emblemed;
+}
+
+static GdkPixbuf * image_icon_load ( GIcon *gicon, gboolean is_link, gboolean is_broken, uint16_t icon_size )
+{
+	GdkPixbuf *pixbuf = NULL;
+	GtkIconInfo *icon_info = NULL;
+
+	GtkIconTheme *icon_theme = gtk_icon_theme_get_default ();
+	GIcon *unknown = NULL, *emblemed = NULL;
+
+	if ( gicon )
+	{
+		if ( is_link ) emblemed = image_icon_emblemed ( "emblem-symbolic-link", NULL, gicon );
+
+		icon_info = gtk_icon_theme_lookup_by_gicon ( icon_theme, ( is_link ) ? emblemed : gicon, icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR );
+	}
+
+	if ( !icon_info && is_link )
+	{
+		unknown = g_themed_icon_new ( "unknown" );
+
+		if ( emblemed ) g_object_unref ( emblemed );
+
+		if ( is_broken )
+			emblemed = image_icon_emblemed ( "dialog-error", "emblem-symbolic-link", unknown );
+		else
+			emblemed = image_icon_emblemed ( "emblem-symbolic-link", NULL, unknown );
+
+		icon_info = gtk_icon_theme_lookup_by_gicon ( icon_theme, emblemed, icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR );
+	}
+
+	if ( icon_info ) pixbuf = gtk_icon_info_load_icon ( icon_info, NULL );
+
+	if ( icon_info ) g_object_unref ( icon_info );
+	if ( unknown ) g_object_unref ( unknown );
+	if ( emblemed ) g_object_unref ( emblemed );
+
+	return pixbuf;
+}
+
+GdkPixbuf * image_icon_get ( GIcon *gicon, const char *content_type, gboolean is_link, uint16_t icon_size )
+{
+	gboolean found = FALSE;
+	gboolean is_broken = ( is_link && content_type && g_str_has_prefix ( content_type, "inode/symlink" ) );
+
+	enum icon_state_enm state = ( is_broken ) ? ICON_LINK_BROKEN : ( is_link ) ? ICON_LINK : ICON_REGULAR;
+
+	g_autofree char *names = ( gicon ) ? g_icon_to_string ( gicon ) : NULL;
+
+	char *key = g_strdup_printf ( "%s|%u|%d", ( names ) ? names : "", icon_size, state );
+
+	GdkPixbuf *pixbuf = image_icon_cache_find ( key, &found );
+
+	if ( found ) { free ( key ); return pixbuf; }
+
+	return image_icon_cache_add ( key, image_icon_load ( gicon, is_link, is_broken, icon_size ) );
+}
+
+GdkPixbuf * image_icon_get_name ( const char *name, uint16_t icon_size, GtkIconLookupFlags flags )
+{
+	gboolean found = FALSE;
+
+	enum icon_state_enm state = ( flags & GTK_ICON_LOOKUP_FORCE_SIZE ) ? ICON_NAME_FORCE : ICON_NAME_REGULAR;
+
+	char *key = g_strdup_printf ( "%s|%u|%d", name, icon_size, state );
+
+	GdkPixbuf *pixbuf = image_icon_cache_find ( key, &found );
+
+	if ( found ) { free ( key ); return pixbuf; }
+
+	return image_icon_cache_add ( key, gtk_icon_theme_load_icon ( gtk_icon_theme_get_default (), name, icon_size, flags, NULL ) );
+}
+
+void image_icon_stats_dump ( void )
+{
+	g_debug ( "%s:: %u icons, %u hits, %u loads", __func__, ( icon_cache ) ? g_hash_table_size ( icon_cache ) : 0, icon_hits, icon_loads );
+
+	icon_hits = icon_loads = 0;
+}
@@ -0,0 +1,20 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+/* Main thread only; the returned pixbuf is a new reference or NULL */
+
+GdkPixbuf * image_icon_get ( GIcon *, const char *, gboolean, uint16_t );
+
+GdkPixbuf * image_icon_get_name ( const char *, uint16_t, GtkIconLookupFlags );
+
+void image_icon_stats_dump ( void );
@@ -0,0 +1,232 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-index.h"
+
+typedef struct _IndexEntry IndexEntry;
+
+struct _IndexEntry
+{
+	char *path;
+	char *key;
+};
+
+struct _ImageIndex
+{
+	char *dir;
+
+	GArray *entries;
+	GFileMonitor *monitor;
+
+	gboolean valid;
+};
+
+static void image_index_entry_clear ( IndexEntry *entry )
+{
+	free ( entry->path );
+	free ( entry->key  );
+}
+
+static int image_index_cmp ( const IndexEntry *a, const IndexEntry *b )
+{
+	int ret = strcmp ( a->key, b->key );
+
+	return ( ret ) ? ret : strcmp ( a->path, b->path );
+}
+
+static void image_index_entry_new ( IndexEntry *entry, const char *dir, const char *name )
+{
+	entry->path = g_build_filename ( dir, name, NULL );
+	entry->key  = g_utf8_collate_key_for_filename ( entry->path, -1 );
+}
+
+/* Position of entry in the sorted array, or where it would be inserted */
+static uint image_index_bsearch ( ImageIndex *index, const IndexEntry *entry, gboolean *found )
+{
+	uint lo = 0, hi = index->entries->len;
+
+	*found = FALSE;
+
+	while ( lo < hi )
+	{
+		uint mid = lo + ( hi - lo ) / 2;
+
+		int ret = image_index_cmp ( &g_array_index ( index->entries, IndexEntry, mid ), entry );
+
+		if ( ret == 0 ) { *found = TRUE; return mid; }
+
+		if ( ret < 0 ) lo = mid + 1; else hi = mid;
+	}
+
+	return lo;
+}
+
+static void image_index_insert ( ImageIndex *index, GFile *file )
+{
+	g_autofree char *path = g_file_get_path ( file );
+
+	if ( !path || !g_file_test ( path, G_FILE_TEST_IS_REGULAR ) ) return;
+
+	gboolean found = FALSE;
+	IndexEntry entry = { path, g_utf8_collate_key_for_filename ( path, -1 ) };
+
+	uint pos = image_index_bsearch ( index, &entry, &found );
+
+	if ( found ) { free ( entry.key ); return; }
+
+	entry.path = g_steal_pointer ( &path );
+
+	g_array_insert_val ( index->entries, pos, entry );
+}
+
+static void image_index_remove ( ImageIndex *index, GFile *file )
+{
+	g_autofree char *path = g_file_get_path ( file );
+
+	if ( !path ) return;
+
+	uint pos = 0;
+
+	if ( image_index_find ( index, path, &pos ) ) g_array_remove_index ( index->entries, pos );
+}
+
+static void image_index_changed ( G_GNUC_UNUSED GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent event, ImageIndex *index )
+{
+	switch ( event )
+	{
+		case G_FILE_MONITOR_EVENT_CREATED:
+		case G_FILE_MONITOR_EVENT_MOVED_IN:
+			image_index_insert ( index, file );
+			break;
+
+		case G_FILE_MONITOR_EVENT_DELETED:
+		case G_FILE_MONITOR_EVENT_MOVED_OUT:
+			image_index_remove ( index, file );
+			break;
+
+		case G_FILE_MONITOR_EVENT_RENAMED:
+			image_index_remove ( index, file );
+			if ( other ) image_index_insert ( index, other );
+			break;
+
+		case G_FILE_MONITOR_EVENT_UNMOUNTED:
+			index->valid = FALSE;
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void image_index_clear ( ImageIndex *index )
+{
+	if ( index->monitor ) { g_file_monitor_cancel ( index->monitor ); g_object_unref ( index->monitor ); }
+
+	index->monitor = NULL;
+
+	g_array_set_size ( index->entries, 0 );
+
+	free ( index->dir );
+	index->dir = NULL;
+
+	index->valid = FALSE;
+}
+
+static void image_index_build ( ImageIndex *index, const char *dir_path )
+{
+	GDir *dir = g_dir_open ( dir_path, 0, NULL );
+
+	if ( !dir ) { g_critical ( "%s: opening directory %s failed.", __func__, dir_path ); return; }
+
+	const char *name = NULL;
+
+	while ( ( name = g_dir_read_name ( dir ) ) != NULL )
+	{
+		IndexEntry entry;
+		image_index_entry_new ( &entry, dir_path, name );
+
+		if ( g_file_test ( entry.path, G_FILE_TEST_IS_REGULAR ) )
+			g_array_append_val ( index->entries, entry );
+		else
+			image_index_entry_clear ( &entry );
+	}
+
+	g_dir_close ( dir );
+
+	g_array_sort ( index->entries, (GCompareFunc)image_index_cmp );
+}
+
+/* Rebuilt only for a new directory or after the monitor lost track of it */
+gboolean image_index_open ( ImageIndex *index, const char *dir_path )
+{
+	if ( index->valid && index->dir && g_str_equal ( index->dir, dir_path ) ) return FALSE;
+
+	int64_t t = g_get_monotonic_time ();
+
+	image_index_clear ( index );
+
+	index->dir = g_strdup ( dir_path );
+
+	GFile *file = g_file_new_for_path ( dir_path );
+	index->monitor = g_file_monitor_directory ( file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL );
+
+	if ( index->monitor ) g_signal_connect ( index->monitor, "changed", G_CALLBACK ( image_index_changed ), index );
+
+	g_object_unref ( file );
+
+	image_index_build ( index, dir_path );
+
+	index->valid = ( index->monitor != NULL );
+
+	g_debug ( "%s:: %u entries, %.2f ms :: %s", __func__, index->entries->len, (double)( g_get_monotonic_time () - t ) / 1000, dir_path );
+
+	return TRUE;
+}
+
+uint image_index_get_len ( ImageIndex *index )
+{
+	return index->entries->len;
+}
+
+const char * image_index_get_path ( ImageIndex *index, uint pos )
+{
+	return g_array_index ( index->entries, IndexEntry, pos ).path;
+}
+
+gboolean image_index_find ( ImageIndex *index, const char *path, uint *pos )
+{
+	gboolean found = FALSE;
+	IndexEntry entry = { (char *)path, g_utf8_collate_key_for_filename ( path, -1 ) };
+
+	*pos = image_index_bsearch ( index, &entry, &found );
+
+	free ( entry.key );
+
+	return found;
+}
+
+void image_index_free ( ImageIndex *index )
+{
+	image_index_clear ( index );
+
+	g_array_unref ( index->entries );
+
+	free ( index );
+}
+
+ImageIndex * image_index_new ( void )
+{
+	ImageIndex *index = g_new0 ( ImageIndex, 1 );
+
+	index->entries = g_array_new ( FALSE, FALSE, sizeof ( IndexEntry ) );
+
+	g_array_set_clear_func ( index->entries, (GDestroyNotify)image_index_entry_clear );
+
+	return index;
+}
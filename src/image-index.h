@@ -0,0 +1,26 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+typedef struct _ImageIndex ImageIndex;
+
+ImageIndex * image_index_new ( void );
+
+void image_index_free ( ImageIndex * );
+
+gboolean image_index_open ( ImageIndex *, const char * );
+
+uint image_index_get_len ( ImageIndex * );
+
+const char * image_index_get_path ( ImageIndex *, uint );
+
+gboolean image_index_find ( ImageIndex *, const char *, uint * );
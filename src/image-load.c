@@ -0,0 +1,633 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-load.h"
+#include "image-ops.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib/gstdio.h>
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+#define EXIF_MAX_IFD 8
+#define MAP_KEEP 4
+#define PROBE_CHUNK 4096
+#define STREAM_CHUNK ( 64 * 1024 )
+
+typedef struct _LoadMap LoadMap;
+
+struct _LoadMap
+{
+	char *path;
+
+	uint64_t inode;
+	int64_t mtime_ns;
+	uint64_t size;
+
+	GBytes *bytes;
+};
+
+static int load_stats[STAT_N];
+
+void image_load_stat ( enum stat_enm num )
+{
+	g_atomic_int_inc ( &load_stats[num] );
+}
+
+/* Counts are reset by the dump */
+void image_load_stats_dump ( const char *what, uint items )
+{
+	int stat = (int)g_atomic_int_and ( &load_stats[STAT_STAT], 0 );
+	int open = (int)g_atomic_int_and ( &load_stats[STAT_OPEN], 0 );
+	int map  = (int)g_atomic_int_and ( &load_stats[STAT_MAP],  0 );
+
+	double n = ( items ) ? items : 1;
+
+	g_debug ( "%s:: %s: %u items, stat %d ( %.2f ), open %d ( %.2f ), mmap %d ( %.2f )", __func__, what, items, stat, stat / n, open, open / n, map, map / n );
+}
+
+static inline uint16_t image_load_u16 ( const uint8_t *p, gboolean le )
+{
+	return ( le ) ? (uint16_t)( p[0] | p[1] << 8 ) : (uint16_t)( p[0] << 8 | p[1] );
+}
+
+static inline uint32_t image_load_u32 ( const uint8_t *p, gboolean le )
+{
+	return ( le ) ? (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24
+	              : (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+/* Walks the IFD chain of a TIFF structure: Orientation from IFD0, the largest JPEG preview from any IFD */
+static void image_load_exif_tiff ( const uint8_t *tiff, size_t size, size_t base, ImageLoad *load )
+{
+	if ( size < 8 ) return;
+
+	gboolean le = ( tiff[0] == 'I' && tiff[1] == 'I' );
+
+	if ( !le && !( tiff[0] == 'M' && tiff[1] == 'M' ) ) return;
+	if ( image_load_u16 ( tiff + 2, le ) != 42 ) return;
+
+	uint32_t ifd = image_load_u32 ( tiff + 4, le );
+
+	uint8_t n = 0; for ( n = 0; ifd && n < EXIF_MAX_IFD; n++ )
+	{
+		if ( (size_t)ifd + 2 > size ) break;
+
+		uint16_t count = image_load_u16 ( tiff + ifd, le );
+
+		if ( (size_t)ifd + 2 + (size_t)count * 12 + 4 > size ) break;
+
+		uint32_t offset = 0, length = 0;
+
+		uint16_t c = 0; for ( c = 0; c < count; c++ )
+		{
+			const uint8_t *entry = tiff + ifd + 2 + c * 12;
+
+			uint16_t tag  = image_load_u16 ( entry, le );
+			uint16_t type = image_load_u16 ( entry + 2, le );
+
+			uint32_t value = ( type == 3 ) ? image_load_u16 ( entry + 8, le ) : image_load_u32 ( entry + 8, le );
+
+			if ( tag == 0x0112 && n == 0 && value >= 1 && value <= 8 ) load->orientation = (uint8_t)value;
+
+			if ( tag == 0x0201 ) offset = value;
+			if ( tag == 0x0202 ) length = value;
+		}
+
+		if ( offset && length && (size_t)offset + length <= size && length > load->prv_length )
+		{
+			load->prv_offset = (uint32_t)( base + offset );
+			load->prv_length = length;
+		}
+
+		ifd = image_load_u32 ( tiff + ifd + 2 + count * 12, le );
+	}
+}
+
+/* JPEG: the TIFF structure sits in the APP1 "Exif" segment; TIFF: the file itself */
+static void image_load_exif ( const uint8_t *data, size_t size, ImageLoad *load )
+{
+	if ( size > 4 && data[0] == 0xFF && data[1] == 0xD8 )
+	{
+		size_t pos = 2;
+
+		while ( pos + 4 <= size && data[pos] == 0xFF )
+		{
+			uint8_t marker = data[pos + 1];
+			size_t len = (size_t)( data[pos + 2] << 8 | data[pos + 3] );
+
+			if ( marker == 0xDA || marker == 0xD9 || len < 2 || pos + 2 + len > size ) break;
+
+			if ( marker == 0xE1 && len > 8 && memcmp ( data + pos + 4, "Exif\0\0", 6 ) == 0 )
+			{
+				image_load_exif_tiff ( data + pos + 10, len - 8, pos + 10, load );
+
+				break;
+			}
+
+			pos += 2 + len;
+		}
+
+		return;
+	}
+
+	image_load_exif_tiff ( data, size, 0, load );
+}
+
+/* Size, mtime and inode only; enough to validate a cached decode */
+gboolean image_load_mtime ( const char *path, ImageLoad *load, GError **error )
+{
+	GStatBuf st;
+
+	image_load_stat ( STAT_STAT );
+
+	if ( g_stat ( path, &st ) != 0 )
+	{
+		int err = errno;
+		g_set_error ( error, G_FILE_ERROR, g_file_error_from_errno ( err ), "%s: %s", path, g_strerror ( err ) );
+
+		return FALSE;
+	}
+
+	load->size  = (uint64_t)st.st_size;
+	load->mtime = (int64_t)st.st_mtime;
+
+	load->inode    = (uint64_t)st.st_ino;
+	load->mtime_ns = (int64_t)st.st_mtim.tv_sec * G_GINT64_CONSTANT ( 1000000000 ) + st.st_mtim.tv_nsec;
+
+	return TRUE;
+}
+
+/* Files mapped by a probe, handed to the decode that follows it on any thread.
+   The decode takes its mapping out: nothing stays mapped past one probe -> decode sequence. */
+static GMutex load_map_lock;
+static LoadMap load_maps[MAP_KEEP];
+
+static void image_load_map_clear ( LoadMap *map )
+{
+	if ( map->bytes ) g_bytes_unref ( map->bytes );
+
+	free ( map->path );
+
+	map->path  = NULL;
+	map->bytes = NULL;
+}
+
+/* A file truncated by another client under a live mapping raises SIGBUS: network and FUSE mounts are read instead */
+static gboolean image_load_remote ( G_GNUC_UNUSED int fd )
+{
+#ifdef __linux__
+	struct statfs sfs;
+
+	if ( fstatfs ( fd, &sfs ) != 0 ) return FALSE;
+
+	switch ( (uint32_t)sfs.f_type )
+	{
+		case 0x6969:     /* NFS   */
+		case 0x517b:     /* SMB   */
+		case 0xff534d42: /* CIFS  */
+		case 0xfe534d42: /* SMB2  */
+		case 0x65735546: /* FUSE  */
+		case 0x01021997: /* 9P    */
+		case 0x00c36400: /* Ceph  */
+		case 0x5346414f: /* AFS   */
+			return TRUE;
+	}
+#endif
+
+	return FALSE;
+}
+
+/* Hints the whole buffer; the mapping is page aligned, a read buffer is rounded down to its page */
+static void image_load_advise ( GBytes *bytes, int advice )
+{
+	gsize len = 0;
+	const uint8_t *data = g_bytes_get_data ( bytes, &len );
+
+	if ( !len ) return;
+
+	uintptr_t page  = (uintptr_t)sysconf ( _SC_PAGESIZE );
+	uintptr_t start = (uintptr_t)data & ~( page - 1 );
+
+	madvise ( (void *)start, (uintptr_t)data + len - start, advice );
+}
+
+/* Kept mappings match on inode, mtime in ns and size, which the probe's stat set in load;
+   keep: the probe leaves the mapping for the decode, every other reader takes it out */
+static GBytes * image_load_map ( const char *path, ImageLoad *load, gboolean keep, GError **error )
+{
+	GBytes *bytes = NULL;
+
+	g_mutex_lock ( &load_map_lock );
+
+	uint8_t c = 0; for ( c = 0; c < MAP_KEEP; c++ )
+		if ( load_maps[c].path && load_maps[c].inode == load->inode && load_maps[c].mtime_ns == load->mtime_ns 
+			&& load_maps[c].size == load->size && g_str_equal ( load_maps[c].path, path ) ) break;
+
+	if ( c < MAP_KEEP )
+	{
+		LoadMap map = load_maps[c];
+
+		bytes = g_bytes_ref ( map.bytes );
+
+		if ( keep )
+		{
+			memmove ( &load_maps[1], &load_maps[0], c * sizeof ( LoadMap ) );
+
+			load_maps[0] = map;
+		}
+		else
+		{
+			image_load_map_clear ( &load_maps[c] );
+
+			memmove ( &load_maps[c], &load_maps[c + 1], ( MAP_KEEP - 1 - c ) * sizeof ( LoadMap ) );
+
+			memset ( &load_maps[MAP_KEEP - 1], 0, sizeof ( LoadMap ) );
+		}
+	}
+
+	g_mutex_unlock ( &load_map_lock );
+
+	if ( bytes ) return bytes;
+
+	image_load_stat ( STAT_OPEN );
+
+	int fd = g_open ( path, O_RDONLY | O_CLOEXEC, 0 );
+
+	struct stat st;
+
+	if ( fd == -1 || fstat ( fd, &st ) != 0 )
+	{
+		int err = errno;
+		g_set_error ( error, G_FILE_ERROR, g_file_error_from_errno ( err ), "%s: %s", path, g_strerror ( err ) );
+
+		if ( fd != -1 ) close ( fd );
+
+		return NULL;
+	}
+
+	if ( image_load_remote ( fd ) )
+	{
+		close ( fd );
+
+		char *contents = NULL;
+		gsize len = 0;
+
+		if ( !g_file_get_contents ( path, &contents, &len, error ) ) return NULL;
+
+		bytes = g_bytes_new_take ( contents, len );
+	}
+	else
+	{
+		image_load_stat ( STAT_MAP );
+
+		GMappedFile *mapped = g_mapped_file_new_from_fd ( fd, FALSE, error );
+
+		close ( fd );
+
+		if ( !mapped ) return NULL;
+
+		bytes = g_mapped_file_get_bytes ( mapped );
+
+		g_mapped_file_unref ( mapped );
+	}
+
+	load->size     = (uint64_t)st.st_size;
+	load->inode    = (uint64_t)st.st_ino;
+	load->mtime_ns = (int64_t)st.st_mtim.tv_sec * G_GINT64_CONSTANT ( 1000000000 ) + st.st_mtim.tv_nsec;
+
+	if ( !keep ) return bytes;
+
+	g_mutex_lock ( &load_map_lock );
+
+	image_load_map_clear ( &load_maps[MAP_KEEP - 1] );
+
+	memmove ( &load_maps[1], &load_maps[0], ( MAP_KEEP - 1 ) * sizeof ( LoadMap ) );
+
+	load_maps[0].path     = g_strdup ( path );
+	load_maps[0].inode    = load->inode;
+	load_maps[0].mtime_ns = load->mtime_ns;
+	load_maps[0].size     = load->size;
+	load_maps[0].bytes    = g_bytes_ref ( bytes );
+
+	g_mutex_unlock ( &load_map_lock );
+
+	return bytes;
+}
+
+/* The mapped file for readers outside this module */
+GBytes * image_load_bytes ( const char *path, ImageLoad *load, GError **error )
+{
+	if ( !load->mtime && !image_load_mtime ( path, load, error ) ) return NULL;
+
+	return image_load_map ( path, load, FALSE, error );
+}
+
+typedef struct _LoadSize LoadSize;
+
+struct _LoadSize
+{
+	int width;
+	int height;
+
+	int set_w;
+	int set_h;
+
+	GdkPixbufFormat *format;
+};
+
+/* Probe: records the size and stops the loader from allocating the image; decode: sets the target size */
+static void image_load_size_prepared ( GdkPixbufLoader *loader, int width, int height, LoadSize *size )
+{
+	size->width  = width;
+	size->height = height;
+	size->format = gdk_pixbuf_loader_get_format ( loader );
+
+	gdk_pixbuf_loader_set_size ( loader, size->set_w, size->set_h );
+}
+
+/* Header only: size, format and EXIF, no pixel data is decoded here.
+   A caller that already knows mtime and size ( directory enumeration ) fills them in and saves the stat. */
+gboolean image_load_probe ( const char *path, ImageLoad *load, GError **error )
+{
+	int64_t t = g_get_monotonic_time ();
+
+	if ( !load->mtime && !image_load_mtime ( path, load, error ) ) return FALSE;
+
+	GBytes *bytes = image_load_map ( path, load, TRUE, error );
+
+	if ( !bytes ) return FALSE;
+
+	gsize len = 0;
+	const uint8_t *data = g_bytes_get_data ( bytes, &len );
+
+	LoadSize size = { 0 };
+	GdkPixbufLoader *loader = gdk_pixbuf_loader_new ();
+
+	g_signal_connect ( loader, "size-prepared", G_CALLBACK ( image_load_size_prepared ), &size );
+
+	gsize pos = 0; for ( pos = 0; pos < len && !size.format; pos += PROBE_CHUNK )
+		if ( !gdk_pixbuf_loader_write ( loader, data + pos, MIN ( PROBE_CHUNK, len - pos ), NULL ) ) break;
+
+	gdk_pixbuf_loader_close ( loader, NULL );
+
+	g_object_unref ( loader );
+
+	if ( size.format )
+	{
+		g_autofree char *name = gdk_pixbuf_format_get_name ( size.format );
+
+		g_strlcpy ( load->format, name, sizeof ( load->format ) );
+
+		load->org_w = size.width;
+		load->org_h = size.height;
+
+		image_load_exif ( data, len, load );
+	}
+
+	g_bytes_unref ( bytes );
+
+	load->t_probe = g_get_monotonic_time () - t;
+
+	if ( size.format == NULL )
+	{
+		g_set_error ( error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_UNKNOWN_TYPE, "%s: unrecognized image file format", path );
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+typedef struct _LoadStream LoadStream;
+
+struct _LoadStream
+{
+	LoadFunc func;
+	gpointer data;
+
+	GCancellable *cancel;
+
+	int rows;
+};
+
+/* Rows arrive top down; a progressive or interlaced pass covers the whole image with each scan */
+static void image_load_area_updated ( GdkPixbufLoader *loader, G_GNUC_UNUSED int x, int y, G_GNUC_UNUSED int w, int h, LoadStream *stream )
+{
+	stream->rows = MAX ( stream->rows, y + h );
+
+	if ( stream->func ) stream->func ( gdk_pixbuf_loader_get_pixbuf ( loader ), stream->rows, stream->data );
+}
+
+/* Without a stream the whole buffer goes in one write; with one in STREAM_CHUNK slices,
+   so a slow mount delivers partial images as its pages fault in. set_w / set_h <= 0 means original size. */
+static GdkPixbuf * image_load_decode_bytes ( GBytes *bytes, const char *type, int set_w, int set_h, LoadStream *stream, GError **error )
+{
+	LoadSize size = { 0 };
+	size.set_w = set_w;
+	size.set_h = set_h;
+
+	GdkPixbufLoader *loader = ( type ) ? gdk_pixbuf_loader_new_with_type ( type, error ) : gdk_pixbuf_loader_new ();
+
+	if ( !loader ) return NULL;
+
+	if ( set_w > 0 && set_h > 0 ) g_signal_connect ( loader, "size-prepared", G_CALLBACK ( image_load_size_prepared ), &size );
+
+	gboolean ok = TRUE;
+
+	if ( stream )
+	{
+		g_signal_connect ( loader, "area-updated", G_CALLBACK ( image_load_area_updated ), stream );
+
+		gsize len = 0;
+		const uint8_t *data = g_bytes_get_data ( bytes, &len );
+
+		gsize pos = 0; for ( pos = 0; ok && pos < len; pos += STREAM_CHUNK )
+		{
+			if ( g_cancellable_set_error_if_cancelled ( stream->cancel, error ) ) { ok = FALSE; break; }
+
+			ok = gdk_pixbuf_loader_write ( loader, data + pos, MIN ( STREAM_CHUNK, len - pos ), error );
+		}
+	}
+	else
+		ok = gdk_pixbuf_loader_write_bytes ( loader, bytes, error );
+
+	ok = gdk_pixbuf_loader_close ( loader, ( ok ) ? error : NULL ) && ok;
+
+	GdkPixbuf *pixbuf = ( ok ) ? gdk_pixbuf_loader_get_pixbuf ( loader ) : NULL;
+
+	if ( pixbuf ) g_object_ref ( pixbuf );
+
+	g_object_unref ( loader );
+
+	return pixbuf;
+}
+
+/* An embedded preview is used only if it covers the target size and has the aspect of the image */
+static GdkPixbuf * image_load_decode_preview ( GBytes *bytes, int set_w, int set_h, ImageLoad *load )
+{
+	if ( !load->prv_length || load->org_w <= 0 || load->org_h <= 0 ) return NULL;
+
+	if ( (size_t)load->prv_offset + load->prv_length > g_bytes_get_size ( bytes ) ) return NULL;
+
+	GBytes *prv = g_bytes_new_from_bytes ( bytes, load->prv_offset, load->prv_length );
+
+	GdkPixbuf *pixbuf = image_load_decode_bytes ( prv, "jpeg", 0, 0, NULL, NULL );
+
+	g_bytes_unref ( prv );
+
+	if ( !pixbuf ) return NULL;
+
+	int pw = gdk_pixbuf_get_width  ( pixbuf );
+	int ph = gdk_pixbuf_get_height ( pixbuf );
+
+	double aspect = (double)load->org_w / load->org_h - (double)pw / ph;
+
+	if ( ABS ( aspect ) > 0.01 || pw < set_w || ph < set_h )
+	{
+		g_object_unref ( pixbuf );
+
+		return NULL;
+	}
+
+	if ( pw == set_w && ph == set_h ) return pixbuf;
+
+	GdkPixbuf *pb_scale = image_ops_scale ( pixbuf, set_w, set_h, OPS_BOX );
+
+	g_object_unref ( pixbuf );
+
+	return pb_scale;
+}
+
+/* Loaders read front to back: only the full decode lets the kernel read ahead further and drop pages behind */
+static GdkPixbuf * image_load_decode_full_bytes ( GBytes *bytes, int set_w, int set_h, LoadStream *stream, GError **error )
+{
+	image_load_advise ( bytes, MADV_SEQUENTIAL );
+
+	GdkPixbuf *pixbuf = image_load_decode_bytes ( bytes, NULL, set_w, set_h, stream, error );
+
+	image_load_advise ( bytes, MADV_NORMAL );
+
+	return pixbuf;
+}
+
+/* The only place a file is decoded; max_w / max_h <= 0 means original size.
+   Downscaled requests set the loader size in size-prepared, so the JPEG loader
+   decodes with DCT scaling ( 1/2, 1/4, 1/8 ) and never holds the full resolution. */
+static GdkPixbuf * image_load_decode_full ( const char *path, int max_w, int max_h, ImageLoad *load, LoadStream *stream, GError **error )
+{
+	int64_t t = g_get_monotonic_time ();
+
+	if ( !load->mtime && !image_load_mtime ( path, load, error ) ) return NULL;
+
+	GBytes *bytes = image_load_map ( path, load, FALSE, error );
+
+	if ( !bytes ) return NULL;
+
+	GdkPixbuf *pixbuf = NULL;
+
+	gboolean fit = ( max_w > 0 && max_h > 0 && load->org_w > 0 && load->org_h > 0 );
+
+	if ( fit && ( load->org_w > max_w || load->org_h > max_h ) )
+	{
+		double scale = MIN ( (double)max_w / load->org_w, (double)max_h / load->org_h );
+
+		int set_w = MAX ( 1, (int)( load->org_w * scale + 0.5 ) );
+		int set_h = MAX ( 1, (int)( load->org_h * scale + 0.5 ) );
+
+		pixbuf = image_load_decode_preview ( bytes, set_w, set_h, load );
+
+		load->preview = ( pixbuf != NULL );
+
+		if ( !pixbuf ) pixbuf = image_load_decode_full_bytes ( bytes, set_w, set_h, stream, error );
+	}
+	else
+		pixbuf = image_load_decode_full_bytes ( bytes, 0, 0, stream, error );
+
+	g_bytes_unref ( bytes );
+
+	if ( error && *error ) g_prefix_error ( error, "%s: ", path );
+
+	load->decodes++;
+	load->t_decode += g_get_monotonic_time () - t;
+
+	if ( pixbuf && ( load->org_w <= 0 || load->org_h <= 0 ) )
+	{
+		load->org_w = gdk_pixbuf_get_width  ( pixbuf );
+		load->org_h = gdk_pixbuf_get_height ( pixbuf );
+	}
+
+	return pixbuf;
+}
+
+GdkPixbuf * image_load_decode ( const char *path, int max_w, int max_h, ImageLoad *load, GError **error )
+{
+	return image_load_decode_full ( path, max_w, max_h, load, NULL, error );
+}
+
+/* Same decode; func gets the loader's partial pixbuf and the number of rows decoded so far, on the calling thread */
+GdkPixbuf * image_load_decode_stream ( const char *path, int max_w, int max_h, ImageLoad *load, GCancellable *cancel, LoadFunc func, gpointer data, GError **error )
+{
+	LoadStream stream = { func, data, cancel, 0 };
+
+	return image_load_decode_full ( path, max_w, max_h, load, &stream, error );
+}
+
+/* All frames of an animation; the loader composites them as the iterator advances */
+GdkPixbufAnimation * image_load_animation ( const char *path, ImageLoad *load, GError **error )
+{
+	int64_t t = g_get_monotonic_time ();
+
+	if ( !load->mtime && !image_load_mtime ( path, load, error ) ) return NULL;
+
+	GBytes *bytes = image_load_map ( path, load, FALSE, error );
+
+	if ( !bytes ) return NULL;
+
+	GdkPixbufLoader *loader = gdk_pixbuf_loader_new ();
+
+	image_load_advise ( bytes, MADV_SEQUENTIAL );
+
+	gboolean ok = gdk_pixbuf_loader_write_bytes ( loader, bytes, error );
+
+	ok = gdk_pixbuf_loader_close ( loader, ( ok ) ? error : NULL ) && ok;
+
+	image_load_advise ( bytes, MADV_NORMAL );
+
+	GdkPixbufAnimation *anim = ( ok ) ? gdk_pixbuf_loader_get_animation ( loader ) : NULL;
+
+	if ( anim ) g_object_ref ( anim );
+
+	g_object_unref ( loader );
+	g_bytes_unref ( bytes );
+
+	if ( error && *error ) g_prefix_error ( error, "%s: ", path );
+
+	load->decodes++;
+	load->t_decode += g_get_monotonic_time () - t;
+
+	if ( anim && ( load->org_w <= 0 || load->org_h <= 0 ) )
+	{
+		load->org_w = gdk_pixbuf_animation_get_width  ( anim );
+		load->org_h = gdk_pixbuf_animation_get_height ( anim );
+	}
+
+	return anim;
+}
+
+void image_load_debug ( const char *path, int64_t t_display, ImageLoad *load )
+{
+	g_debug ( "%s:: probe %.2f ms, decode %.2f ms ( %u%s ), display %.2f ms :: %s", __func__, 
+		(double)load->t_probe / 1000, (double)load->t_decode / 1000, load->decodes, ( load->preview ) ? ", preview" : "", (double)t_display / 1000, path );
+}
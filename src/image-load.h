@@ -0,0 +1,67 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+enum stat_enm
+{
+	STAT_STAT,
+	STAT_OPEN,
+	STAT_MAP,
+	STAT_N
+};
+
+typedef void ( *LoadFunc ) ( GdkPixbuf *, int, gpointer );
+
+typedef struct _ImageLoad ImageLoad;
+
+struct _ImageLoad
+{
+	int org_w;
+	int org_h;
+
+	uint64_t size;
+	int64_t mtime;
+
+	uint64_t inode;
+	int64_t mtime_ns;
+
+	uint8_t orientation;
+
+	char format[16];
+
+	uint32_t prv_offset;
+	uint32_t prv_length;
+
+	uint8_t decodes;
+	gboolean preview;
+
+	int64_t t_probe;
+	int64_t t_decode;
+};
+
+gboolean image_load_mtime ( const char *, ImageLoad *, GError ** );
+
+gboolean image_load_probe ( const char *, ImageLoad *, GError ** );
+
+GdkPixbuf * image_load_decode ( const char *, int, int, ImageLoad *, GError ** );
+
+GBytes * image_load_bytes ( const char *, ImageLoad *, GError ** );
+
+GdkPixbufAnimation * image_load_animation ( const char *, ImageLoad *, GError ** );
+
+GdkPixbuf * image_load_decode_stream ( const char *, int, int, ImageLoad *, GCancellable *, LoadFunc, gpointer, GError ** );
+
+void image_load_debug ( const char *, int64_t, ImageLoad * );
+
+void image_load_stat ( enum stat_enm );
+
+void image_load_stats_dump ( const char *, uint );
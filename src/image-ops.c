@@ -0,0 +1,873 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-ops.h"
+
+#include <math.h>
+
+#if defined ( __x86_64__ ) || defined ( __i386__ )
+#define OPS_X86 1
+#include <immintrin.h>
+#define OPS_TARGET(t) __attribute__ ( ( target ( t ) ) )
+#endif
+
+#define OPS_PRECISION 14
+#define OPS_BLOCK 64
+#define OPS_BAND_PIXELS ( 256 * 1024 )
+
+/*
+* Scaling is two separable passes with 14-bit fixed point weights, the same
+* arithmetic in every variant: the scalar code is the reference, IMAGE_OPS_CPU=scalar
+* (or sse2, ssse3) caps the dispatch to compare against it. Large jobs are split
+* into row bands on a shared pool; the calling thread takes a band as well.
+*/
+
+enum ops_cpu_enm
+{
+	OPS_CPU_SCALAR,
+	OPS_CPU_SSE2,
+	OPS_CPU_SSSE3,
+	OPS_CPU_AVX2,
+	OPS_CPU_N
+};
+
+static const char *ops_cpu_name_n[OPS_CPU_N] = { "scalar", "sse2", "ssse3", "avx2" };
+
+typedef struct _OpsKernel OpsKernel;
+
+struct _OpsKernel
+{
+	int ksize;
+
+	int *bounds;
+	int16_t *coeffs;
+};
+
+typedef void ( *OpsRowH ) ( const uint8_t *, int, uint8_t *, int, const OpsKernel *, int );
+typedef void ( *OpsRowV ) ( const uint8_t *, int, uint8_t *, int, const int16_t *, int );
+typedef void ( *OpsRowRgb ) ( const uint8_t *, uint32_t *, int );
+
+typedef struct _OpsFuncs OpsFuncs;
+
+struct _OpsFuncs
+{
+	enum ops_cpu_enm cpu;
+
+	OpsRowH row_h;
+	OpsRowV row_v;
+	OpsRowRgb row_rgb;
+};
+
+static OpsFuncs ops;
+
+static GThreadPool *ops_pool = NULL;
+static uint ops_threads = 1;
+
+typedef void ( *OpsBandFunc ) ( gpointer, int, int );
+
+typedef struct _OpsBands OpsBands;
+
+struct _OpsBands
+{
+	OpsBandFunc func;
+	gpointer data;
+
+	int rows;
+	int n;
+	int next;
+	int helpers;
+
+	GMutex lock;
+	GCond  cond;
+};
+
+static inline uint8_t image_ops_clamp ( int v )
+{
+	return (uint8_t)( ( v < 0 ) ? 0 : ( v > 255 ) ? 255 : v );
+}
+
+static inline int image_ops_pair ( int16_t k0, int16_t k1 )
+{
+	return (int)( (uint32_t)(uint16_t)k0 | (uint32_t)(uint16_t)k1 << 16 );
+}
+
+/* Row bands */
+
+static void image_ops_bands_run ( OpsBands *bands )
+{
+	int b = 0; while ( ( b = g_atomic_int_add ( &bands->next, 1 ) ) < bands->n )
+		bands->func ( bands->data, (int)( (int64_t)bands->rows * b / bands->n ), (int)( (int64_t)bands->rows * ( b + 1 ) / bands->n ) );
+}
+
+static void image_ops_bands_thread ( OpsBands *bands, G_GNUC_UNUSED gpointer data )
+{
+	image_ops_bands_run ( bands );
+
+	g_mutex_lock ( &bands->lock );
+
+	bands->helpers--;
+	g_cond_signal ( &bands->cond );
+
+	g_mutex_unlock ( &bands->lock );
+}
+
+static void image_ops_bands ( OpsBandFunc func, gpointer data, int rows, int row_pixels )
+{
+	uint64_t n = MIN ( (uint64_t)rows * (uint64_t)row_pixels / OPS_BAND_PIXELS, MIN ( ops_threads, (uint64_t)rows ) );
+
+	if ( n <= 1 || !ops_pool ) { func ( data, 0, rows ); return; }
+
+	OpsBands bands = { .func = func, .data = data, .rows = rows, .n = (int)n, .next = 0, .helpers = (int)n - 1 };
+
+	g_mutex_init ( &bands.lock );
+	g_cond_init  ( &bands.cond );
+
+	int c = 0; for ( c = 1; c < bands.n; c++ ) g_thread_pool_push ( ops_pool, &bands, NULL );
+
+	image_ops_bands_run ( &bands );
+
+	g_mutex_lock ( &bands.lock );
+
+	while ( bands.helpers ) g_cond_wait ( &bands.cond, &bands.lock );
+
+	g_mutex_unlock ( &bands.lock );
+
+	g_mutex_clear ( &bands.lock );
+	g_cond_clear  ( &bands.cond );
+}
+
+/* Scalar reference kernels */
+
+static void image_ops_row_h_scalar ( const uint8_t *src, G_GNUC_UNUSED int src_bytes, uint8_t *dst, int dst_w, const OpsKernel *kernel, int n_ch )
+{
+	int x = 0; for ( x = 0; x < dst_w; x++ )
+	{
+		const uint8_t *s = src + kernel->bounds[x * 2] * n_ch;
+		const int16_t *k = kernel->coeffs + x * kernel->ksize;
+
+		int count = kernel->bounds[x * 2 + 1];
+
+		int c = 0; for ( c = 0; c < n_ch; c++ )
+		{
+			int sum = 1 << ( OPS_PRECISION - 1 );
+
+			int i = 0; for ( i = 0; i < count; i++ ) sum += s[i * n_ch + c] * k[i];
+
+			dst[x * n_ch + c] = image_ops_clamp ( sum >> OPS_PRECISION );
+		}
+	}
+}
+
+static void image_ops_row_v_scalar ( const uint8_t *src, int stride, uint8_t *dst, int bytes, const int16_t *k, int count )
+{
+	int b = 0; for ( b = 0; b < bytes; b++ )
+	{
+		int sum = 1 << ( OPS_PRECISION - 1 );
+
+		int i = 0; for ( i = 0; i < count; i++ ) sum += src[(size_t)i * (size_t)stride + (size_t)b] * k[i];
+
+		dst[b] = image_ops_clamp ( sum >> OPS_PRECISION );
+	}
+}
+
+static void image_ops_row_rgb_scalar ( const uint8_t *s, uint32_t *d, int w )
+{
+	int c = 0; for ( c = 0; c < w; c++, s += 3 )
+		d[c] = 0xff000000u | (uint32_t)s[0] << 16 | (uint32_t)s[1] << 8 | s[2];
+}
+
+static void image_ops_row_rgba_scalar ( const uint8_t *s, uint32_t *d, int w )
+{
+	int c = 0; for ( c = 0; c < w; c++, s += 4 )
+	{
+		uint32_t a = s[3];
+
+		if ( a == 255 )
+			d[c] = 0xff000000u | (uint32_t)s[0] << 16 | (uint32_t)s[1] << 8 | s[2];
+		else
+			d[c] = a << 24 | ( ( s[0] * a + 127 ) / 255 ) << 16 | ( ( s[1] * a + 127 ) / 255 ) << 8 | ( ( s[2] * a + 127 ) / 255 );
+	}
+}
+
+#ifdef OPS_X86
+
+/* Two rows at a time: bytes of both rows interleaved to 16-bit pairs, one madd per pair of taps */
+OPS_TARGET ( "sse2" ) static void image_ops_row_v_sse2 ( const uint8_t *src, int stride, uint8_t *dst, int bytes, const int16_t *k, int count )
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i half = _mm_set1_epi32 ( 1 << ( OPS_PRECISION - 1 ) );
+
+	int b = 0; for ( b = 0; b + 16 <= bytes; b += 16 )
+	{
+		__m128i s0 = half, s1 = half, s2 = half, s3 = half;
+
+		int i = 0; for ( i = 0; i < count; i += 2 )
+		{
+			gboolean pair = ( i + 1 < count );
+
+			__m128i a = _mm_loadu_si128 ( (const __m128i *)( src + (size_t)i * (size_t)stride + (size_t)b ) );
+			__m128i c = ( pair ) ? _mm_loadu_si128 ( (const __m128i *)( src + (size_t)( i + 1 ) * (size_t)stride + (size_t)b ) ) : zero;
+
+			__m128i kk = _mm_set1_epi32 ( image_ops_pair ( k[i], ( pair ) ? k[i + 1] : 0 ) );
+
+			__m128i lo = _mm_unpacklo_epi8 ( a, c );
+			__m128i hi = _mm_unpackhi_epi8 ( a, c );
+
+			s0 = _mm_add_epi32 ( s0, _mm_madd_epi16 ( _mm_unpacklo_epi8 ( lo, zero ), kk ) );
+			s1 = _mm_add_epi32 ( s1, _mm_madd_epi16 ( _mm_unpackhi_epi8 ( lo, zero ), kk ) );
+			s2 = _mm_add_epi32 ( s2, _mm_madd_epi16 ( _mm_unpacklo_epi8 ( hi, zero ), kk ) );
+			s3 = _mm_add_epi32 ( s3, _mm_madd_epi16 ( _mm_unpackhi_epi8 ( hi, zero ), kk ) );
+		}
+
+		__m128i p01 = _mm_packs_epi32 ( _mm_srai_epi32 ( s0, OPS_PRECISION ), _mm_srai_epi32 ( s1, OPS_PRECISION ) );
+		__m128i p23 = _mm_packs_epi32 ( _mm_srai_epi32 ( s2, OPS_PRECISION ), _mm_srai_epi32 ( s3, OPS_PRECISION ) );
+
+		_mm_storeu_si128 ( (__m128i *)( dst + b ), _mm_packus_epi16 ( p01, p23 ) );
+	}
+
+	if ( b < bytes ) image_ops_row_v_scalar ( src + b, stride, dst + b, bytes - b, k, count );
+}
+
+/* Same as sse2 on 32 bytes; the in-lane unpacks and packs cancel out, no permutes needed */
+OPS_TARGET ( "avx2" ) static void image_ops_row_v_avx2 ( const uint8_t *src, int stride, uint8_t *dst, int bytes, const int16_t *k, int count )
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	const __m256i half = _mm256_set1_epi32 ( 1 << ( OPS_PRECISION - 1 ) );
+
+	int b = 0; for ( b = 0; b + 32 <= bytes; b += 32 )
+	{
+		__m256i s0 = half, s1 = half, s2 = half, s3 = half;
+
+		int i = 0; for ( i = 0; i < count; i += 2 )
+		{
+			gboolean pair = ( i + 1 < count );
+
+			__m256i a = _mm256_loadu_si256 ( (const __m256i *)( src + (size_t)i * (size_t)stride + (size_t)b ) );
+			__m256i c = ( pair ) ? _mm256_loadu_si256 ( (const __m256i *)( src + (size_t)( i + 1 ) * (size_t)stride + (size_t)b ) ) : zero;
+
+			__m256i kk = _mm256_set1_epi32 ( image_ops_pair ( k[i], ( pair ) ? k[i + 1] : 0 ) );
+
+			__m256i lo = _mm256_unpacklo_epi8 ( a, c );
+			__m256i hi = _mm256_unpackhi_epi8 ( a, c );
+
+			s0 = _mm256_add_epi32 ( s0, _mm256_madd_epi16 ( _mm256_unpacklo_epi8 ( lo, zero ), kk ) );
+			s1 = _mm256_add_epi32 ( s1, _mm256_madd_epi16 ( _mm256_unpackhi_epi8 ( lo, zero ), kk ) );
+			s2 = _mm256_add_epi32 ( s2, _mm256_madd_epi16 ( _mm256_unpacklo_epi8 ( hi, zero ), kk ) );
+			s3 = _mm256_add_epi32 ( s3, _mm256_madd_epi16 ( _mm256_unpackhi_epi8 ( hi, zero ), kk ) );
+		}
+
+		__m256i p01 = _mm256_packs_epi32 ( _mm256_srai_epi32 ( s0, OPS_PRECISION ), _mm256_srai_epi32 ( s1, OPS_PRECISION ) );
+		__m256i p23 = _mm256_packs_epi32 ( _mm256_srai_epi32 ( s2, OPS_PRECISION ), _mm256_srai_epi32 ( s3, OPS_PRECISION ) );
+
+		_mm256_storeu_si256 ( (__m256i *)( dst + b ), _mm256_packus_epi16 ( p01, p23 ) );
+	}
+
+	if ( b < bytes ) image_ops_row_v_sse2 ( src + b, stride, dst + b, bytes - b, k, count );
+}
+
+/* Two taps per madd: pshufb spreads the channels of two neighbours into 16-bit pairs, RGB and RGBA alike */
+OPS_TARGET ( "ssse3" ) static void image_ops_row_h_ssse3 ( const uint8_t *src, int src_bytes, uint8_t *dst, int dst_w, const OpsKernel *kernel, int n_ch )
+{
+	const __m128i mask_2 = ( n_ch == 4 ) ? _mm_setr_epi8 ( 0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1 )
+	                                     : _mm_setr_epi8 ( 0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1 );
+
+	const __m128i mask_1 = _mm_setr_epi8 ( 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3, -1, -1, -1 );
+	const __m128i half = _mm_set1_epi32 ( 1 << ( OPS_PRECISION - 1 ) );
+
+	int x = 0; for ( x = 0; x < dst_w; x++ )
+	{
+		int xmin  = kernel->bounds[x * 2];
+		int count = kernel->bounds[x * 2 + 1];
+		int left  = src_bytes - xmin * n_ch;
+
+		const uint8_t *s = src + xmin * n_ch;
+		const int16_t *k = kernel->coeffs + x * kernel->ksize;
+
+		__m128i sum = half;
+
+		int i = 0; for ( i = 0; i + 1 < count && i * n_ch + 8 <= left; i += 2 )
+		{
+			__m128i pix = _mm_shuffle_epi8 ( _mm_loadl_epi64 ( (const __m128i *)( s + i * n_ch ) ), mask_2 );
+
+			sum = _mm_add_epi32 ( sum, _mm_madd_epi16 ( pix, _mm_set1_epi32 ( image_ops_pair ( k[i], k[i + 1] ) ) ) );
+		}
+
+		for ( ; i < count; i++ )
+		{
+			uint32_t v = 0;
+			memcpy ( &v, s + i * n_ch, (size_t)n_ch );
+
+			__m128i pix = _mm_shuffle_epi8 ( _mm_cvtsi32_si128 ( (int)v ), mask_1 );
+
+			sum = _mm_add_epi32 ( sum, _mm_madd_epi16 ( pix, _mm_set1_epi32 ( image_ops_pair ( k[i], 0 ) ) ) );
+		}
+
+		sum = _mm_srai_epi32 ( sum, OPS_PRECISION );
+		sum = _mm_packs_epi32 ( sum, sum );
+		sum = _mm_packus_epi16 ( sum, sum );
+
+		uint32_t out = (uint32_t)_mm_cvtsi128_si32 ( sum );
+
+		memcpy ( dst + x * n_ch, &out, (size_t)n_ch );
+	}
+}
+
+OPS_TARGET ( "ssse3" ) static void image_ops_row_rgb_ssse3 ( const uint8_t *s, uint32_t *d, int w )
+{
+	const __m128i mask  = _mm_setr_epi8 ( 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1 );
+	const __m128i alpha = _mm_set1_epi32 ( (int)0xff000000 );
+
+	int c = 0; for ( c = 0; c + 6 <= w; c += 4 )
+	{
+		__m128i v = _mm_loadu_si128 ( (const __m128i *)( s + c * 3 ) );
+
+		_mm_storeu_si128 ( (__m128i *)( d + c ), _mm_or_si128 ( _mm_shuffle_epi8 ( v, mask ), alpha ) );
+	}
+
+	image_ops_row_rgb_scalar ( s + c * 3, d + c, w - c );
+}
+
+OPS_TARGET ( "avx2" ) static void image_ops_row_rgb_avx2 ( const uint8_t *s, uint32_t *d, int w )
+{
+	const __m256i mask  = _mm256_setr_epi8 ( 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1 );
+	const __m256i alpha = _mm256_set1_epi32 ( (int)0xff000000 );
+
+	int c = 0; for ( c = 0; c + 10 <= w; c += 8 )
+	{
+		__m128i lo = _mm_loadu_si128 ( (const __m128i *)( s + c * 3 ) );
+		__m128i hi = _mm_loadu_si128 ( (const __m128i *)( s + c * 3 + 12 ) );
+
+		__m256i v = _mm256_inserti128_si256 ( _mm256_castsi128_si256 ( lo ), hi, 1 );
+
+		_mm256_storeu_si256 ( (__m256i *)( d + c ), _mm256_or_si256 ( _mm256_shuffle_epi8 ( v, mask ), alpha ) );
+	}
+
+	image_ops_row_rgb_ssse3 ( s + c * 3, d + c, w - c );
+}
+
+#endif
+
+static gpointer image_ops_init_once ( G_GNUC_UNUSED gpointer data )
+{
+	enum ops_cpu_enm cap = OPS_CPU_AVX2;
+
+	const char *env = g_getenv ( "IMAGE_OPS_CPU" );
+
+	uint8_t c = 0; for ( c = 0; env && c < OPS_CPU_N; c++ ) if ( g_str_equal ( env, ops_cpu_name_n[c] ) ) cap = c;
+
+	ops.cpu = OPS_CPU_SCALAR;
+	ops.row_h = image_ops_row_h_scalar;
+	ops.row_v = image_ops_row_v_scalar;
+	ops.row_rgb = image_ops_row_rgb_scalar;
+
+#ifdef OPS_X86
+	__builtin_cpu_init ();
+
+	if ( cap >= OPS_CPU_SSE2 && __builtin_cpu_supports ( "sse2" ) )
+		{ ops.cpu = OPS_CPU_SSE2; ops.row_v = image_ops_row_v_sse2; }
+
+	if ( cap >= OPS_CPU_SSSE3 && __builtin_cpu_supports ( "ssse3" ) )
+		{ ops.cpu = OPS_CPU_SSSE3; ops.row_h = image_ops_row_h_ssse3; ops.row_rgb = image_ops_row_rgb_ssse3; }
+
+	if ( cap >= OPS_CPU_AVX2 && __builtin_cpu_supports ( "avx2" ) )
+		{ ops.cpu = OPS_CPU_AVX2; ops.row_v = image_ops_row_v_avx2; ops.row_rgb = image_ops_row_rgb_avx2; }
+#endif
+
+	ops_threads = CLAMP ( g_get_num_processors (), 1, 16 );
+
+	if ( ops_threads > 1 ) ops_pool = g_thread_pool_new ( (GFunc)image_ops_bands_thread, NULL, (int)ops_threads - 1, FALSE, NULL );
+
+	g_debug ( "%s:: %s, %u threads", __func__, ops_cpu_name_n[ops.cpu], ops_threads );
+
+	return NULL;
+}
+
+static void image_ops_init ( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	g_once ( &once, image_ops_init_once, NULL );
+}
+
+const char * image_ops_get_cpu ( void )
+{
+	image_ops_init ();
+
+	return ops_cpu_name_n[ops.cpu];
+}
+
+/* Scale */
+
+static double image_ops_filter_box ( double x )
+{
+	return ( x > -0.5 && x <= 0.5 ) ? 1.0 : 0.0;
+}
+
+static double image_ops_filter_bilinear ( double x )
+{
+	x = fabs ( x );
+
+	return ( x < 1.0 ) ? 1.0 - x : 0.0;
+}
+
+static double image_ops_sinc ( double x )
+{
+	if ( x == 0.0 ) return 1.0;
+
+	x *= G_PI;
+
+	return sin ( x ) / x;
+}
+
+static double image_ops_filter_lanczos ( double x )
+{
+	return ( x > -3.0 && x < 3.0 ) ? image_ops_sinc ( x ) * image_ops_sinc ( x / 3.0 ) : 0.0;
+}
+
+typedef struct _OpsFilter OpsFilter;
+
+struct _OpsFilter
+{
+	double ( *func ) ( double );
+	double support;
+};
+
+static const OpsFilter ops_filter_n[] =
+{
+	[OPS_BOX]      = { image_ops_filter_box,      0.5 },
+	[OPS_BILINEAR] = { image_ops_filter_bilinear, 1.0 },
+	[OPS_LANCZOS]  = { image_ops_filter_lanczos,  3.0 }
+};
+
+static void image_ops_kernel_free ( OpsKernel *kernel )
+{
+	if ( !kernel ) return;
+
+	free ( kernel->bounds );
+	free ( kernel->coeffs );
+	free ( kernel );
+}
+
+/* Weights for each output pixel, normalised so that they sum to exactly 1 << OPS_PRECISION */
+static OpsKernel * image_ops_kernel_new ( int in_size, int out_size, enum ops_filter_enm filter )
+{
+	double scale   = (double)in_size / out_size;
+	double fscale  = MAX ( scale, 1.0 );
+	double support = ops_filter_n[filter].support * fscale;
+
+	OpsKernel *kernel = g_new0 ( OpsKernel, 1 );
+
+	kernel->ksize  = (int)ceil ( support ) * 2 + 1;
+	kernel->bounds = g_new0 ( int, (size_t)out_size * 2 );
+	kernel->coeffs = g_new0 ( int16_t, (size_t)out_size * (size_t)kernel->ksize );
+
+	double *w = g_new0 ( double, (size_t)kernel->ksize );
+
+	int x = 0; for ( x = 0; x < out_size; x++ )
+	{
+		double center = ( x + 0.5 ) * scale;
+
+		int xmin  = MAX ( 0, (int)( center - support + 0.5 ) );
+		int xmax  = MIN ( in_size, (int)( center + support + 0.5 ) );
+		int count = MIN ( xmax - xmin, kernel->ksize );
+
+		double sum = 0;
+
+		int i = 0; for ( i = 0; i < count; i++ )
+		{
+			w[i] = ops_filter_n[filter].func ( ( i + xmin - center + 0.5 ) / fscale );
+
+			sum += w[i];
+		}
+
+		if ( sum == 0 ) { xmin = CLAMP ( (int)center, 0, in_size - 1 ); count = 1; w[0] = sum = 1; }
+
+		int16_t *k = kernel->coeffs + (size_t)x * (size_t)kernel->ksize;
+
+		int isum = 0, imax = 0;
+
+		for ( i = 0; i < count; i++ )
+		{
+			k[i] = (int16_t)floor ( w[i] / sum * ( 1 << OPS_PRECISION ) + 0.5 );
+
+			isum += k[i];
+
+			if ( k[i] > k[imax] ) imax = i;
+		}
+
+		k[imax] = (int16_t)( k[imax] + ( 1 << OPS_PRECISION ) - isum );
+
+		kernel->bounds[x * 2] = xmin;
+		kernel->bounds[x * 2 + 1] = count;
+	}
+
+	free ( w );
+
+	return kernel;
+}
+
+typedef struct _OpsScale OpsScale;
+
+struct _OpsScale
+{
+	const uint8_t *src;
+	int src_stride;
+	int src_w;
+
+	uint8_t *tmp;
+	int tmp_stride;
+
+	uint8_t *dst;
+	int dst_stride;
+	int dst_w;
+
+	int n_ch;
+
+	OpsKernel *kx;
+	OpsKernel *ky;
+};
+
+static void image_ops_scale_h_band ( OpsScale *sc, int y1, int y2 )
+{
+	int y = 0; for ( y = y1; y < y2; y++ )
+		ops.row_h ( sc->src + (size_t)y * (size_t)sc->src_stride, sc->src_w * sc->n_ch, sc->tmp + (size_t)y * (size_t)sc->tmp_stride, sc->dst_w, sc->kx, sc->n_ch );
+}
+
+static void image_ops_scale_v_band ( OpsScale *sc, int y1, int y2 )
+{
+	int y = 0; for ( y = y1; y < y2; y++ )
+	{
+		int ymin  = sc->ky->bounds[y * 2];
+		int count = sc->ky->bounds[y * 2 + 1];
+
+		ops.row_v ( sc->tmp + (size_t)ymin * (size_t)sc->tmp_stride, sc->tmp_stride, sc->dst + (size_t)y * (size_t)sc->dst_stride,
+			sc->dst_w * sc->n_ch, sc->ky->coeffs + (size_t)y * (size_t)sc->ky->ksize, count );
+	}
+}
+
+GdkPixbuf * image_ops_scale ( GdkPixbuf *pixbuf, int width, int height, enum ops_filter_enm filter )
+{
+	int src_w = gdk_pixbuf_get_width  ( pixbuf );
+	int src_h = gdk_pixbuf_get_height ( pixbuf );
+	int n_ch  = gdk_pixbuf_get_n_channels ( pixbuf );
+
+	if ( width == src_w && height == src_h ) return g_object_ref ( pixbuf );
+
+	/* Straight alpha would bleed the colour of transparent pixels into the edges; gdk-pixbuf weights by alpha */
+	if ( gdk_pixbuf_get_has_alpha ( pixbuf ) || n_ch != 3 || gdk_pixbuf_get_bits_per_sample ( pixbuf ) != 8 )
+		return gdk_pixbuf_scale_simple ( pixbuf, width, height, ( filter == OPS_BOX ) ? GDK_INTERP_TILES : GDK_INTERP_BILINEAR );
+
+	image_ops_init ();
+
+	GdkPixbuf *pb_dst = gdk_pixbuf_new ( GDK_COLORSPACE_RGB, FALSE, 8, width, height );
+
+	if ( !pb_dst ) return NULL;
+
+	OpsScale sc = { 0 };
+
+	sc.src = gdk_pixbuf_get_pixels ( pixbuf );
+	sc.src_stride = gdk_pixbuf_get_rowstride ( pixbuf );
+	sc.src_w = src_w;
+
+	sc.dst = gdk_pixbuf_get_pixels ( pb_dst );
+	sc.dst_stride = gdk_pixbuf_get_rowstride ( pb_dst );
+	sc.dst_w = width;
+
+	sc.n_ch = n_ch;
+
+	uint8_t *tmp = NULL;
+
+	if ( width != src_w )
+	{
+		sc.kx = image_ops_kernel_new ( src_w, width, filter );
+
+		if ( height == src_h )
+			{ sc.tmp = sc.dst; sc.tmp_stride = sc.dst_stride; }
+		else
+			{ sc.tmp = tmp = g_malloc ( (size_t)width * (size_t)n_ch * (size_t)src_h ); sc.tmp_stride = width * n_ch; }
+
+		image_ops_bands ( (OpsBandFunc)image_ops_scale_h_band, &sc, src_h, width * sc.kx->ksize / 2 );
+	}
+	else
+		{ sc.tmp = (uint8_t *)sc.src; sc.tmp_stride = sc.src_stride; }
+
+	if ( height != src_h )
+	{
+		sc.ky = image_ops_kernel_new ( src_h, height, filter );
+
+		image_ops_bands ( (OpsBandFunc)image_ops_scale_v_band, &sc, height, width * sc.ky->ksize / 2 );
+	}
+
+	image_ops_kernel_free ( sc.kx );
+	image_ops_kernel_free ( sc.ky );
+
+	free ( tmp );
+
+	return pb_dst;
+}
+
+/* Orientation */
+
+typedef struct _OpsOrient OpsOrient;
+
+struct _OpsOrient
+{
+	const uint8_t *src;
+	int src_stride;
+	int src_w;
+	int src_h;
+
+	uint8_t *dst;
+	int dst_stride;
+	int dst_w;
+
+	int n_ch;
+	uint8_t orient;
+
+	ptrdiff_t step;
+};
+
+/* Source pixel of destination pixel ( dx, dy ) */
+static inline const uint8_t * image_ops_orient_ptr ( OpsOrient *op, int dx, int dy )
+{
+	int w = op->src_w, h = op->src_h, sx = dx, sy = dy;
+
+	switch ( op->orient )
+	{
+		case 2: sx = w - 1 - dx; sy = dy; break;
+		case 3: sx = w - 1 - dx; sy = h - 1 - dy; break;
+		case 4: sx = dx; sy = h - 1 - dy; break;
+		case 5: sx = dy; sy = dx; break;
+		case 6: sx = dy; sy = h - 1 - dx; break;
+		case 7: sx = w - 1 - dy; sy = h - 1 - dx; break;
+		case 8: sx = w - 1 - dy; sy = dx; break;
+		default: break;
+	}
+
+	return op->src + (size_t)sy * (size_t)op->src_stride + (size_t)sx * (size_t)op->n_ch;
+}
+
+static void image_ops_orient_run ( OpsOrient *op, int dx, int n, int dy )
+{
+	const uint8_t *s = image_ops_orient_ptr ( op, dx, dy );
+	uint8_t *d = op->dst + (size_t)dy * (size_t)op->dst_stride + (size_t)dx * (size_t)op->n_ch;
+
+	if ( op->step == op->n_ch ) { memcpy ( d, s, (size_t)n * (size_t)op->n_ch ); return; }
+
+	int c = 0;
+
+	if ( op->n_ch == 4 )
+		for ( c = 0; c < n; c++, d += 4, s += op->step ) memcpy ( d, s, 4 );
+	else if ( op->n_ch == 3 )
+		for ( c = 0; c < n; c++, d += 3, s += op->step ) memcpy ( d, s, 3 );
+	else
+		for ( c = 0; c < n; c++, d += op->n_ch, s += op->step ) memcpy ( d, s, (size_t)op->n_ch );
+}
+
+#ifdef OPS_X86
+
+/* Quarter turns of RGBA: 4x4 pixel blocks transposed in registers; returns the first row left to the scalar path */
+OPS_TARGET ( "sse2" ) static int image_ops_orient_sse2 ( OpsOrient *op, int bx, int bw, int y1, int y2 )
+{
+	gboolean rev = ( op->orient == 7 || op->orient == 8 );
+
+	int dy = 0; for ( dy = y1; dy + 4 <= y2; dy += 4 )
+	{
+		int dx = 0; for ( dx = bx; dx + 4 <= bx + bw; dx += 4 )
+		{
+			const uint8_t *s = image_ops_orient_ptr ( op, dx, ( rev ) ? dy + 3 : dy );
+
+			__m128i r0 = _mm_loadu_si128 ( (const __m128i *)( s ) );
+			__m128i r1 = _mm_loadu_si128 ( (const __m128i *)( s + op->step ) );
+			__m128i r2 = _mm_loadu_si128 ( (const __m128i *)( s + op->step * 2 ) );
+			__m128i r3 = _mm_loadu_si128 ( (const __m128i *)( s + op->step * 3 ) );
+
+			__m128i a = _mm_unpacklo_epi32 ( r0, r1 );
+			__m128i b = _mm_unpacklo_epi32 ( r2, r3 );
+			__m128i c = _mm_unpackhi_epi32 ( r0, r1 );
+			__m128i d = _mm_unpackhi_epi32 ( r2, r3 );
+
+			__m128i t[4] = { _mm_unpacklo_epi64 ( a, b ), _mm_unpackhi_epi64 ( a, b ), _mm_unpacklo_epi64 ( c, d ), _mm_unpackhi_epi64 ( c, d ) };
+
+			uint8_t *dst = op->dst + (size_t)dy * (size_t)op->dst_stride + (size_t)dx * 4;
+
+			int j = 0; for ( j = 0; j < 4; j++ )
+				_mm_storeu_si128 ( (__m128i *)( dst + (size_t)j * (size_t)op->dst_stride ), t[( rev ) ? 3 - j : j] );
+		}
+
+		if ( dx < bx + bw )
+		{
+			int j = 0; for ( j = 0; j < 4; j++ ) image_ops_orient_run ( op, dx, bx + bw - dx, dy + j );
+		}
+	}
+
+	return dy;
+}
+
+#endif
+
+static void image_ops_orient_band ( OpsOrient *op, int y1, int y2 )
+{
+	int bx = 0; for ( bx = 0; bx < op->dst_w; bx += OPS_BLOCK )
+	{
+		int bw = MIN ( OPS_BLOCK, op->dst_w - bx );
+		int dy = y1;
+
+#ifdef OPS_X86
+		if ( op->orient >= 5 && op->n_ch == 4 && ops.cpu >= OPS_CPU_SSE2 ) dy = image_ops_orient_sse2 ( op, bx, bw, y1, y2 );
+#endif
+
+		for ( ; dy < y2; dy++ ) image_ops_orient_run ( op, bx, bw, dy );
+	}
+}
+
+/* The 8 orientations are the symmetries of a square ( D4 ): each is a 2x2 matrix on centred coordinates, y down */
+static const int8_t ops_orient_n[9][4] =
+{
+	{  0,  0,  0,  0 },
+	{  1,  0,  0,  1 },
+	{ -1,  0,  0,  1 },
+	{ -1,  0,  0, -1 },
+	{  1,  0,  0, -1 },
+	{  0,  1,  1,  0 },
+	{  0, -1,  1,  0 },
+	{  0, -1, -1,  0 },
+	{  0,  1, -1,  0 }
+};
+
+/* a, then b: the product b * a */
+uint8_t image_ops_orient_compose ( uint8_t a, uint8_t b )
+{
+	if ( a < 1 || a > 8 ) a = 1;
+	if ( b < 1 || b > 8 ) b = 1;
+
+	const int8_t *ma = ops_orient_n[a], *mb = ops_orient_n[b];
+
+	int8_t m[4] = { (int8_t)( mb[0] * ma[0] + mb[1] * ma[2] ), (int8_t)( mb[0] * ma[1] + mb[1] * ma[3] ),
+	                (int8_t)( mb[2] * ma[0] + mb[3] * ma[2] ), (int8_t)( mb[2] * ma[1] + mb[3] * ma[3] ) };
+
+	uint8_t c = 1; for ( c = 1; c <= 8; c++ ) if ( memcmp ( m, ops_orient_n[c], sizeof ( m ) ) == 0 ) return c;
+
+	return 1;
+}
+
+/* The same transform for drawing: maps a w x h image onto its oriented box */
+void image_ops_orient_matrix ( uint8_t orient, int w, int h, cairo_matrix_t *matrix )
+{
+	if ( orient < 1 || orient > 8 ) orient = 1;
+
+	const int8_t *m = ops_orient_n[orient];
+
+	double x0 = ( ( m[0] < 0 ) ? w : 0 ) + ( ( m[1] < 0 ) ? h : 0 );
+	double y0 = ( ( m[2] < 0 ) ? w : 0 ) + ( ( m[3] < 0 ) ? h : 0 );
+
+	cairo_matrix_init ( matrix, m[0], m[2], m[1], m[3], x0, y0 );
+}
+
+/* Any flip and quarter turn in one pass, cache blocked */
+GdkPixbuf * image_ops_orient ( GdkPixbuf *pixbuf, uint8_t orient )
+{
+	if ( orient < 2 || orient > 8 || gdk_pixbuf_get_bits_per_sample ( pixbuf ) != 8 ) return g_object_ref ( pixbuf );
+
+	image_ops_init ();
+
+	int w = gdk_pixbuf_get_width  ( pixbuf );
+	int h = gdk_pixbuf_get_height ( pixbuf );
+
+	gboolean swap = ( orient >= 5 );
+
+	GdkPixbuf *pb_dst = gdk_pixbuf_new ( GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha ( pixbuf ), 8, ( swap ) ? h : w, ( swap ) ? w : h );
+
+	if ( !pb_dst ) return NULL;
+
+	OpsOrient op = { 0 };
+
+	op.src = gdk_pixbuf_get_pixels ( pixbuf );
+	op.src_stride = gdk_pixbuf_get_rowstride ( pixbuf );
+	op.src_w = w;
+	op.src_h = h;
+
+	op.dst = gdk_pixbuf_get_pixels ( pb_dst );
+	op.dst_stride = gdk_pixbuf_get_rowstride ( pb_dst );
+	op.dst_w = gdk_pixbuf_get_width ( pb_dst );
+
+	op.n_ch = gdk_pixbuf_get_n_channels ( pixbuf );
+	op.orient = orient;
+
+	op.step = ( orient == 5 || orient == 8 ) ? op.src_stride : ( orient == 6 || orient == 7 ) ? -op.src_stride : ( orient == 4 ) ? op.n_ch : -op.n_ch;
+
+	image_ops_bands ( (OpsBandFunc)image_ops_orient_band, &op, gdk_pixbuf_get_height ( pb_dst ), op.dst_w );
+
+	return pb_dst;
+}
+
+/* Conversion */
+
+typedef struct _OpsConvert OpsConvert;
+
+struct _OpsConvert
+{
+	const uint8_t *src;
+	int src_stride;
+	int n_ch;
+	gboolean alpha;
+
+	uint8_t *dst;
+	int dst_stride;
+	int w;
+};
+
+static void image_ops_convert_band ( OpsConvert *cv, int y1, int y2 )
+{
+	int r = 0; for ( r = y1; r < y2; r++ )
+	{
+		const uint8_t *s = cv->src + (size_t)r * (size_t)cv->src_stride;
+		uint32_t *d = (uint32_t *)( cv->dst + (size_t)r * (size_t)cv->dst_stride );
+
+		if ( cv->alpha ) image_ops_row_rgba_scalar ( s, d, cv->w ); else ops.row_rgb ( s, d, cv->w );
+	}
+}
+
+/* RGB(A) rows to native-endian premultiplied ARGB32, as cairo expects */
+void image_ops_to_argb32 ( GdkPixbuf *pixbuf, int x, int y, int w, int h, uint8_t *dst, int dst_stride )
+{
+	image_ops_init ();
+
+	OpsConvert cv = { 0 };
+
+	cv.n_ch = gdk_pixbuf_get_n_channels ( pixbuf );
+	cv.alpha = gdk_pixbuf_get_has_alpha ( pixbuf );
+	cv.src_stride = gdk_pixbuf_get_rowstride ( pixbuf );
+	cv.src = gdk_pixbuf_get_pixels ( pixbuf ) + (size_t)y * (size_t)cv.src_stride + (size_t)x * (size_t)cv.n_ch;
+
+	cv.dst = dst;
+	cv.dst_stride = dst_stride;
+	cv.w = w;
+
+	image_ops_bands ( (OpsBandFunc)image_ops_convert_band, &cv, h, w );
+}
+
+/* A pixbuf as a cairo image surface, converted once */
+cairo_surface_t * image_ops_surface ( GdkPixbuf *pixbuf )
+{
+	int w = gdk_pixbuf_get_width  ( pixbuf );
+	int h = gdk_pixbuf_get_height ( pixbuf );
+
+	cairo_surface_t *surface = cairo_image_surface_create ( CAIRO_FORMAT_ARGB32, w, h );
+
+	if ( cairo_surface_status ( surface ) != CAIRO_STATUS_SUCCESS ) { cairo_surface_destroy ( surface ); return NULL; }
+
+	cairo_surface_flush ( surface );
+
+	image_ops_to_argb32 ( pixbuf, 0, 0, w, h, cairo_image_surface_get_data ( surface ), cairo_image_surface_get_stride ( surface ) );
+
+	cairo_surface_mark_dirty ( surface );
+
+	return surface;
+}
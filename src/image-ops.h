@@ -0,0 +1,35 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+enum ops_filter_enm
+{
+	OPS_BOX,
+	OPS_BILINEAR,
+	OPS_LANCZOS
+};
+
+/* Orientation codes are the EXIF ones: 1 as stored, 2-8 flips and quarter turns */
+
+GdkPixbuf * image_ops_scale ( GdkPixbuf *, int, int, enum ops_filter_enm );
+
+GdkPixbuf * image_ops_orient ( GdkPixbuf *, uint8_t );
+
+uint8_t image_ops_orient_compose ( uint8_t, uint8_t );
+
+void image_ops_orient_matrix ( uint8_t, int, int, cairo_matrix_t * );
+
+void image_ops_to_argb32 ( GdkPixbuf *, int, int, int, int, uint8_t *, int );
+
+cairo_surface_t * image_ops_surface ( GdkPixbuf * );
+
+const char * image_ops_get_cpu ( void );
@@ -0,0 +1,288 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-prefetch.h"
+
+typedef struct _PrefetchEntry PrefetchEntry;
+
+struct _PrefetchEntry
+{
+	char *path;
+
+	int width;
+	int height;
+
+	GdkPixbuf *pixbuf;
+	ImageLoad load;
+
+	GCancellable *cancel;
+
+	gboolean done;
+
+	uint64_t bytes;
+};
+
+typedef struct _PrefetchJob PrefetchJob;
+
+struct _PrefetchJob
+{
+	char *path;
+
+	int width;
+	int height;
+
+	GCancellable *cancel;
+};
+
+struct _ImagePrefetch
+{
+	GMutex lock;
+
+	GThreadPool *pool;
+	GHashTable *entries;
+
+	uint8_t depth;
+	gboolean reverse;
+
+	uint64_t bytes;
+	uint64_t max_bytes;
+};
+
+static void image_prefetch_entry_free ( PrefetchEntry *entry )
+{
+	g_cancellable_cancel ( entry->cancel );
+
+	if ( entry->pixbuf ) g_object_unref ( entry->pixbuf );
+
+	g_object_unref ( entry->cancel );
+
+	free ( entry->path );
+	free ( entry );
+}
+
+static void image_prefetch_job_free ( PrefetchJob *job )
+{
+	g_object_unref ( job->cancel );
+
+	free ( job->path );
+	free ( job );
+}
+
+static void image_prefetch_thread ( PrefetchJob *job, ImagePrefetch *prefetch )
+{
+	g_mutex_lock ( &prefetch->lock );
+
+	PrefetchEntry *entry = g_hash_table_lookup ( prefetch->entries, job->path );
+
+	gboolean run = ( entry && entry->cancel == job->cancel && !g_cancellable_is_cancelled ( job->cancel ) );
+
+	g_mutex_unlock ( &prefetch->lock );
+
+	if ( !run ) { image_prefetch_job_free ( job ); return; }
+
+	ImageLoad load = { 0 };
+	GdkPixbuf *pixbuf = NULL;
+
+	/* An original-size decode that could never fit the budget is not worth the memory spike */
+	gboolean fits = ( image_load_probe ( job->path, &load, NULL ) && ( job->width > 0 || (uint64_t)load.org_w * (uint64_t)load.org_h * 4 <= prefetch->max_bytes ) );
+
+	/* Removing the entry cancels the decode between slices */
+	if ( fits ) pixbuf = image_load_decode_stream ( job->path, job->width, job->height, &load, job->cancel, NULL, NULL, NULL );
+
+	g_mutex_lock ( &prefetch->lock );
+
+	entry = g_hash_table_lookup ( prefetch->entries, job->path );
+
+	if ( entry && entry->cancel == job->cancel && !g_cancellable_is_cancelled ( job->cancel ) )
+	{
+		uint64_t bytes = ( pixbuf ) ? gdk_pixbuf_get_byte_length ( pixbuf ) : 0;
+
+		if ( pixbuf && prefetch->bytes + bytes <= prefetch->max_bytes )
+		{
+			entry->pixbuf = pixbuf;
+			entry->bytes  = bytes;
+
+			prefetch->bytes += bytes;
+
+			pixbuf = NULL;
+		}
+
+		entry->load = load;
+		entry->done = TRUE;
+	}
+
+	g_mutex_unlock ( &prefetch->lock );
+
+	if ( pixbuf ) g_object_unref ( pixbuf );
+
+	image_prefetch_job_free ( job );
+}
+
+static gboolean image_prefetch_remove ( G_GNUC_UNUSED gpointer key, PrefetchEntry *entry, ImagePrefetch *prefetch )
+{
+	prefetch->bytes -= entry->bytes;
+
+	return TRUE;
+}
+
+static gboolean image_prefetch_array_has ( GPtrArray *paths, const char *path )
+{
+	uint c = 0; for ( c = 0; c < paths->len; c++ )
+		if ( g_str_equal ( g_ptr_array_index ( paths, c ), path ) ) return TRUE;
+
+	return FALSE;
+}
+
+/* paths are ordered by priority: nearest in the direction of travel first */
+void image_prefetch_request ( ImagePrefetch *prefetch, GPtrArray *paths, int width, int height, gboolean reverse )
+{
+	g_mutex_lock ( &prefetch->lock );
+
+	gboolean turn = ( reverse != prefetch->reverse );
+
+	prefetch->reverse = reverse;
+
+	GHashTableIter iter;
+	PrefetchEntry *entry = NULL;
+
+	g_hash_table_iter_init ( &iter, prefetch->entries );
+
+	while ( g_hash_table_iter_next ( &iter, NULL, (gpointer *)&entry ) )
+	{
+		gboolean keep = ( entry->width == width && entry->height == height && image_prefetch_array_has ( paths, entry->path ) );
+
+		if ( turn && !entry->done ) keep = FALSE;
+
+		if ( !keep ) { prefetch->bytes -= entry->bytes; g_hash_table_iter_remove ( &iter ); }
+	}
+
+	uint c = 0; for ( c = 0; c < paths->len; c++ )
+	{
+		const char *path = g_ptr_array_index ( paths, c );
+
+		if ( g_hash_table_contains ( prefetch->entries, path ) ) continue;
+
+		entry = g_new0 ( PrefetchEntry, 1 );
+		entry->path   = g_strdup ( path );
+		entry->width  = width;
+		entry->height = height;
+		entry->cancel = g_cancellable_new ();
+
+		g_hash_table_insert ( prefetch->entries, entry->path, entry );
+
+		PrefetchJob *job = g_new0 ( PrefetchJob, 1 );
+		job->path   = g_strdup ( path );
+		job->width  = width;
+		job->height = height;
+		job->cancel = g_object_ref ( entry->cancel );
+
+		g_thread_pool_push ( prefetch->pool, job, NULL );
+	}
+
+	g_mutex_unlock ( &prefetch->lock );
+}
+
+/* Never waits: a decode that is queued or still running is cancelled and the caller streams the image itself */
+GdkPixbuf * image_prefetch_take ( ImagePrefetch *prefetch, const char *path, int width, int height, ImageLoad *load )
+{
+	GdkPixbuf *pixbuf = NULL;
+
+	g_mutex_lock ( &prefetch->lock );
+
+	PrefetchEntry *entry = g_hash_table_lookup ( prefetch->entries, path );
+
+	if ( entry && ( entry->width != width || entry->height != height || !entry->done ) )
+	{
+		prefetch->bytes -= entry->bytes;
+		g_hash_table_remove ( prefetch->entries, path );
+
+		entry = NULL;
+	}
+
+	if ( entry && entry->pixbuf ) { pixbuf = g_object_ref ( entry->pixbuf ); *load = entry->load; }
+
+	g_mutex_unlock ( &prefetch->lock );
+
+	g_debug ( "%s:: %s :: %s", __func__, ( pixbuf ) ? "hit" : "miss", path );
+
+	return pixbuf;
+}
+
+/* TRUE while a decode of path at this size is queued or running */
+gboolean image_prefetch_pending ( ImagePrefetch *prefetch, const char *path, int width, int height )
+{
+	g_mutex_lock ( &prefetch->lock );
+
+	PrefetchEntry *entry = g_hash_table_lookup ( prefetch->entries, path );
+
+	gboolean pending = ( entry && entry->width == width && entry->height == height && !entry->done );
+
+	g_mutex_unlock ( &prefetch->lock );
+
+	return pending;
+}
+
+/* TRUE once the decode of path at this size has finished; a failed or over-budget one too, waiting would not help */
+gboolean image_prefetch_ready ( ImagePrefetch *prefetch, const char *path, int width, int height )
+{
+	g_mutex_lock ( &prefetch->lock );
+
+	PrefetchEntry *entry = g_hash_table_lookup ( prefetch->entries, path );
+
+	gboolean ready = ( entry && entry->width == width && entry->height == height && entry->done );
+
+	g_mutex_unlock ( &prefetch->lock );
+
+	return ready;
+}
+
+void image_prefetch_cancel ( ImagePrefetch *prefetch )
+{
+	g_mutex_lock ( &prefetch->lock );
+
+	g_hash_table_foreach_remove ( prefetch->entries, (GHRFunc)image_prefetch_remove, prefetch );
+
+	g_mutex_unlock ( &prefetch->lock );
+}
+
+uint8_t image_prefetch_get_depth ( ImagePrefetch *prefetch )
+{
+	return prefetch->depth;
+}
+
+void image_prefetch_free ( ImagePrefetch *prefetch )
+{
+	image_prefetch_cancel ( prefetch );
+
+	g_thread_pool_free ( prefetch->pool, FALSE, TRUE );
+
+	g_hash_table_unref ( prefetch->entries );
+
+	g_mutex_clear ( &prefetch->lock );
+
+	free ( prefetch );
+}
+
+ImagePrefetch * image_prefetch_new ( uint8_t depth, uint64_t max_bytes )
+{
+	ImagePrefetch *prefetch = g_new0 ( ImagePrefetch, 1 );
+
+	g_mutex_init ( &prefetch->lock );
+
+	prefetch->depth = depth;
+	prefetch->max_bytes = max_bytes;
+
+	prefetch->entries = g_hash_table_new_full ( g_str_hash, g_str_equal, NULL, (GDestroyNotify)image_prefetch_entry_free );
+
+	int threads = CLAMP ( (int)g_get_num_processors () / 2, 1, depth * 2 );
+
+	prefetch->pool = g_thread_pool_new ( (GFunc)image_prefetch_thread, prefetch, threads, FALSE, NULL );
+
+	return prefetch;
+}
@@ -0,0 +1,30 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include "image-load.h"
+
+typedef struct _ImagePrefetch ImagePrefetch;
+
+ImagePrefetch * image_prefetch_new ( uint8_t, uint64_t );
+
+void image_prefetch_free ( ImagePrefetch * );
+
+void image_prefetch_cancel ( ImagePrefetch * );
+
+void image_prefetch_request ( ImagePrefetch *, GPtrArray *, int, int, gboolean );
+
+GdkPixbuf * image_prefetch_take ( ImagePrefetch *, const char *, int, int, ImageLoad * );
+
+gboolean image_prefetch_pending ( ImagePrefetch *, const char *, int, int );
+
+gboolean image_prefetch_ready ( ImagePrefetch *, const char *, int, int );
+
+uint8_t image_prefetch_get_depth ( ImagePrefetch * );
@@ -0,0 +1,172 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-slide.h"
+
+#include <math.h>
+
+#define SLIDE_LEAD_US ( 50 * 1000 )
+
+/*
+* Deadlines sit on a fixed grid from the start, so decode and drawing time never add up to drift.
+* A timeout sleeps until shortly before the deadline, then the frame clock of the widget takes over
+* and the slide changes on the frame that is presented closest to it. A next image that is still
+* decoding is waited for, at most one interval, and counts as late.
+*/
+struct _ImageSlide
+{
+	GtkWidget *widget;
+
+	SlideFunc next;
+	SlideFunc ready;
+	gpointer data;
+
+	int64_t interval;
+	int64_t deadline;
+	int64_t last;
+
+	uint src_wait;
+	uint tick;
+
+	gboolean running;
+
+	uint count;
+	double sum;
+	double sum2;
+	double worst;
+};
+
+static void image_slide_arm ( ImageSlide * );
+
+/* Interval to the previous change and its error against the nominal one */
+static void image_slide_measure ( ImageSlide *slide, int64_t now )
+{
+	if ( slide->last )
+	{
+		double interval = (double)( now - slide->last ) / 1000;
+		double jitter = interval - (double)slide->interval / 1000;
+
+		slide->count++;
+		slide->sum  += jitter;
+		slide->sum2 += jitter * jitter;
+		slide->worst = MAX ( slide->worst, ABS ( jitter ) );
+
+		g_debug ( "%s:: interval %.2f ms, jitter %+.2f ms", __func__, interval, jitter );
+	}
+
+	slide->last = now;
+}
+
+static gboolean image_slide_tick ( G_GNUC_UNUSED GtkWidget *widget, GdkFrameClock *clock, ImageSlide *slide )
+{
+	int64_t now = gdk_frame_clock_get_frame_time ( clock );
+
+	int64_t refresh = 0;
+	gdk_frame_clock_get_refresh_info ( clock, now, &refresh, NULL );
+
+	if ( now + refresh / 2 < slide->deadline ) return G_SOURCE_CONTINUE;
+
+	if ( !slide->ready ( slide->data ) && now - slide->deadline < slide->interval ) return G_SOURCE_CONTINUE;
+
+	slide->tick = 0;
+
+	image_slide_measure ( slide, now );
+
+	if ( !slide->next ( slide->data ) ) { image_slide_stop ( slide ); return G_SOURCE_REMOVE; }
+
+	slide->deadline += slide->interval;
+
+	/* More than an interval behind ( a hidden window, a very slow decode ): the grid starts over */
+	if ( slide->deadline <= now ) slide->deadline = now + slide->interval;
+
+	image_slide_arm ( slide );
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean image_slide_wait ( ImageSlide *slide )
+{
+	slide->src_wait = 0;
+
+	slide->tick = gtk_widget_add_tick_callback ( slide->widget, (GtkTickCallback)image_slide_tick, slide, NULL );
+
+	return G_SOURCE_REMOVE;
+}
+
+static void image_slide_arm ( ImageSlide *slide )
+{
+	int64_t sleep = slide->deadline - g_get_monotonic_time () - SLIDE_LEAD_US;
+
+	if ( sleep > 0 )
+		slide->src_wait = g_timeout_add ( (uint)( sleep / 1000 ), (GSourceFunc)image_slide_wait, slide );
+	else
+		image_slide_wait ( slide );
+}
+
+/* interval in milliseconds */
+void image_slide_start ( ImageSlide *slide, uint interval )
+{
+	image_slide_stop ( slide );
+
+	slide->interval = (int64_t)MAX ( interval, 1 ) * 1000;
+	slide->deadline = g_get_monotonic_time () + slide->interval;
+	slide->last     = g_get_monotonic_time ();
+	slide->running  = TRUE;
+
+	slide->count = 0;
+	slide->sum   = 0;
+	slide->sum2  = 0;
+	slide->worst = 0;
+
+	image_slide_arm ( slide );
+}
+
+void image_slide_stop ( ImageSlide *slide )
+{
+	if ( slide->src_wait ) g_source_remove ( slide->src_wait );
+	if ( slide->tick ) gtk_widget_remove_tick_callback ( slide->widget, slide->tick );
+
+	slide->src_wait = 0;
+	slide->tick = 0;
+
+	if ( slide->running && slide->count )
+	{
+		double mean = slide->sum / slide->count;
+		double sdev = sqrt ( MAX ( 0, slide->sum2 / slide->count - mean * mean ) );
+
+		g_debug ( "%s:: %u changes at %.0f ms, jitter mean %+.2f ms, sdev %.2f ms, worst %.2f ms", __func__, slide->count, (double)slide->interval / 1000, mean, sdev, slide->worst );
+	}
+
+	slide->running = FALSE;
+}
+
+gboolean image_slide_is_running ( ImageSlide *slide )
+{
+	return slide->running;
+}
+
+void image_slide_free ( ImageSlide *slide )
+{
+	image_slide_stop ( slide );
+
+	free ( slide );
+}
+
+/* next changes the image, FALSE ends the show; ready tells whether the next image is decoded */
+ImageSlide * image_slide_new ( GtkWidget *widget, SlideFunc next, SlideFunc ready, gpointer data )
+{
+	ImageSlide *slide = g_new0 ( ImageSlide, 1 );
+
+	slide->widget = widget;
+	slide->next   = next;
+	slide->ready  = ready;
+	slide->data   = data;
+
+	return slide;
+}
@@ -0,0 +1,26 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+typedef struct _ImageSlide ImageSlide;
+
+typedef gboolean ( *SlideFunc ) ( gpointer );
+
+ImageSlide * image_slide_new ( GtkWidget *, SlideFunc, SlideFunc, gpointer );
+
+void image_slide_free ( ImageSlide * );
+
+void image_slide_start ( ImageSlide *, uint );
+
+void image_slide_stop ( ImageSlide * );
+
+gboolean image_slide_is_running ( ImageSlide * );
@@ -0,0 +1,239 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-stream.h"
+
+#define STREAM_FIRST_US  ( 50 * 1000 )
+#define STREAM_UPDATE_US ( 100 * 1000 )
+
+typedef struct _StreamPost StreamPost;
+
+struct _StreamPost
+{
+	char *path;
+
+	GdkPixbuf *pixbuf;
+	ImageLoad load;
+
+	gboolean done;
+	uint serial;
+};
+
+typedef struct _StreamJob StreamJob;
+
+struct _StreamJob
+{
+	char *path;
+
+	int width;
+	int height;
+
+	ImageLoad load;
+
+	uint serial;
+	GCancellable *cancel;
+
+	int64_t t_start;
+	int64_t t_post;
+
+	ImageStream *stream;
+};
+
+/* One decode at a time on a worker; partial images and the result go to the main loop through a single
+   slot, so a slow main loop only ever sees the latest one */
+struct _ImageStream
+{
+	GMutex lock;
+
+	GThreadPool *pool;
+	GCancellable *cancel;
+
+	StreamPost *post;
+	uint src_post;
+
+	uint serial;
+	gboolean partial;
+
+	StreamFunc func;
+	gpointer data;
+};
+
+static void image_stream_post_free ( StreamPost *post )
+{
+	if ( post->pixbuf ) g_object_unref ( post->pixbuf );
+
+	free ( post->path );
+	free ( post );
+}
+
+static void image_stream_job_free ( StreamJob *job )
+{
+	g_object_unref ( job->cancel );
+
+	free ( job->path );
+	free ( job );
+}
+
+static gboolean image_stream_done ( ImageStream *stream )
+{
+	g_mutex_lock ( &stream->lock );
+
+	StreamPost *post = stream->post;
+
+	stream->post = NULL;
+	stream->src_post = 0;
+
+	gboolean current = ( post && post->serial == stream->serial );
+
+	g_mutex_unlock ( &stream->lock );
+
+	if ( current ) stream->func ( post->path, post->pixbuf, &post->load, post->done, stream->data );
+
+	if ( post ) image_stream_post_free ( post );
+
+	return FALSE;
+}
+
+static void image_stream_post ( StreamJob *job, GdkPixbuf *pixbuf, gboolean done )
+{
+	ImageStream *stream = job->stream;
+
+	StreamPost *post = g_new0 ( StreamPost, 1 );
+
+	post->path   = g_strdup ( job->path );
+	post->pixbuf = pixbuf;
+	post->load   = job->load;
+	post->done   = done;
+	post->serial = job->serial;
+
+	g_mutex_lock ( &stream->lock );
+
+	if ( stream->post ) image_stream_post_free ( stream->post );
+
+	stream->post = post;
+
+	if ( !stream->src_post ) stream->src_post = g_idle_add ( (GSourceFunc)image_stream_done, stream );
+
+	g_mutex_unlock ( &stream->lock );
+}
+
+/* Runs inside the loader write: the copy is taken while the loader is not touching the pixels.
+   A fast decode finishes before STREAM_FIRST_US and shows no partial image at all. */
+static void image_stream_update ( GdkPixbuf *pixbuf, int rows, StreamJob *job )
+{
+	int64_t t = g_get_monotonic_time ();
+
+	if ( !pixbuf || t - job->t_start < STREAM_FIRST_US || t - job->t_post < STREAM_UPDATE_US ) return;
+
+	job->t_post = t;
+
+	GdkPixbuf *copy = gdk_pixbuf_copy ( pixbuf );
+
+	if ( !copy ) return;
+
+	int height = gdk_pixbuf_get_height ( copy );
+
+	/* Rows the loader has not reached yet hold whatever the allocation had */
+	if ( rows < height )
+	{
+		int stride = gdk_pixbuf_get_rowstride ( copy );
+
+		memset ( gdk_pixbuf_get_pixels ( copy ) + (size_t)rows * (size_t)stride, 0, (size_t)( height - rows - 1 ) * (size_t)stride + (size_t)gdk_pixbuf_get_width ( copy ) * (size_t)gdk_pixbuf_get_n_channels ( copy ) );
+	}
+
+	image_stream_post ( job, copy, FALSE );
+}
+
+static void image_stream_thread ( StreamJob *job, ImageStream *stream )
+{
+	if ( g_cancellable_is_cancelled ( job->cancel ) ) { image_stream_job_free ( job ); return; }
+
+	job->t_start = g_get_monotonic_time ();
+
+	GError *error = NULL;
+	GdkPixbuf *pixbuf = image_load_decode_stream ( job->path, job->width, job->height, &job->load, job->cancel, ( stream->partial ) ? (LoadFunc)image_stream_update : NULL, job, &error );
+
+	if ( !pixbuf && !g_cancellable_is_cancelled ( job->cancel ) ) g_warning ( "%s:: %s ", __func__, ( error ) ? error->message : job->path );
+
+	if ( error ) g_error_free ( error );
+
+	if ( !g_cancellable_is_cancelled ( job->cancel ) ) image_stream_post ( job, pixbuf, TRUE );
+	else if ( pixbuf ) g_object_unref ( pixbuf );
+
+	image_stream_job_free ( job );
+}
+
+/* load comes from the probe; the result replaces any decode still running */
+void image_stream_open ( ImageStream *stream, const char *path, int width, int height, ImageLoad *load )
+{
+	image_stream_cancel ( stream );
+
+	StreamJob *job = g_new0 ( StreamJob, 1 );
+
+	job->path   = g_strdup ( path );
+	job->width  = width;
+	job->height = height;
+	job->load   = *load;
+	job->stream = stream;
+	job->serial = stream->serial;
+	job->cancel = g_object_ref ( stream->cancel );
+
+	g_thread_pool_push ( stream->pool, job, NULL );
+}
+
+/* Main thread only; posts of older decodes are dropped by serial */
+void image_stream_cancel ( ImageStream *stream )
+{
+	g_cancellable_cancel ( stream->cancel );
+	g_object_unref ( stream->cancel );
+
+	stream->cancel = g_cancellable_new ();
+
+	g_mutex_lock ( &stream->lock );
+
+	stream->serial++;
+
+	g_mutex_unlock ( &stream->lock );
+}
+
+void image_stream_free ( ImageStream *stream )
+{
+	g_cancellable_cancel ( stream->cancel );
+
+	g_thread_pool_free ( stream->pool, FALSE, TRUE );
+
+	if ( stream->src_post ) g_source_remove ( stream->src_post );
+
+	if ( stream->post ) image_stream_post_free ( stream->post );
+
+	g_object_unref ( stream->cancel );
+
+	g_mutex_clear ( &stream->lock );
+
+	free ( stream );
+}
+
+/* Without partial only the result is posted; the decode can still be cancelled between slices */
+ImageStream * image_stream_new ( gboolean partial, StreamFunc func, gpointer data )
+{
+	ImageStream *stream = g_new0 ( ImageStream, 1 );
+
+	g_mutex_init ( &stream->lock );
+
+	stream->partial = partial;
+
+	stream->func = func;
+	stream->data = data;
+
+	stream->cancel = g_cancellable_new ();
+
+	stream->pool = g_thread_pool_new ( (GFunc)image_stream_thread, stream, 1, FALSE, NULL );
+
+	return stream;
+}
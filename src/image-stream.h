@@ -0,0 +1,24 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include "image-load.h"
+
+typedef struct _ImageStream ImageStream;
+
+typedef void ( *StreamFunc ) ( const char *, GdkPixbuf *, ImageLoad *, gboolean, gpointer );
+
+ImageStream * image_stream_new ( gboolean, StreamFunc, gpointer );
+
+void image_stream_free ( ImageStream * );
+
+void image_stream_open ( ImageStream *, const char *, int, int, ImageLoad * );
+
+void image_stream_cancel ( ImageStream * );
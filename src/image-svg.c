@@ -0,0 +1,517 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-svg.h"
+
+#ifdef HAVE_RSVG
+
+#include "image-load.h"
+
+#include <librsvg/rsvg.h>
+
+#define SVG_BYTES ( SVG_TILE * SVG_TILE * 4 )
+#define SVG_OVERVIEW ( SVG_TILE * 4 )
+#define SVG_ZOOMS 8
+
+/*
+* Vector images are rendered by librsvg at the zoom of the view, in tiles of
+* SVG_TILE pixels, on one worker that owns the handle. Tiles are keyed by zoom
+* and position and kept in a bounded LRU, so zooming back to a recent scale
+* and panning over rendered parts are redraws.
+*/
+
+typedef struct _SvgSource SvgSource;
+
+struct _SvgSource
+{
+	int ref;
+
+	RsvgHandle *handle;
+
+	int width;
+	int height;
+
+	int zoom_id;
+
+	GCancellable *cancel;
+	ImageSvg *svg;
+};
+
+typedef struct _SvgDone SvgDone;
+
+struct _SvgDone
+{
+	SvgSource *source;
+
+	uint64_t key;
+	cairo_surface_t *surface;
+
+	gboolean overview;
+};
+
+typedef struct _SvgEntry SvgEntry;
+
+struct _SvgEntry
+{
+	uint64_t key;
+	cairo_surface_t *surface;
+
+	GList link;
+};
+
+typedef struct _SvgJob SvgJob;
+
+struct _SvgJob
+{
+	SvgSource *source;
+
+	uint64_t key;
+	double zoom;
+
+	gboolean overview;
+};
+
+struct _ImageSvg
+{
+	GMutex lock;
+
+	GThreadPool *pool;
+
+	SvgSource *source;
+	cairo_surface_t *overview;
+
+	double zoom_n[SVG_ZOOMS];
+	uint zoom_id_n[SVG_ZOOMS];
+	uint zoom_next;
+
+	GHashTable *cache;
+	GHashTable *pending;
+	GQueue lru;
+
+	uint64_t bytes;
+	uint64_t max_bytes;
+
+	GSList *done;
+	uint src_done;
+
+	SvgFunc func;
+	gpointer data;
+};
+
+static inline uint64_t image_svg_key ( uint zoom_id, uint tx, uint ty )
+{
+	return (uint64_t)( zoom_id & 0xffffff ) << 40 | (uint64_t)( ty & 0xfffff ) << 20 | ( tx & 0xfffff );
+}
+
+static SvgSource * image_svg_source_ref ( SvgSource *source )
+{
+	g_atomic_int_inc ( &source->ref );
+
+	return source;
+}
+
+static void image_svg_source_unref ( SvgSource *source )
+{
+	if ( !g_atomic_int_dec_and_test ( &source->ref ) ) return;
+
+	g_object_unref ( source->handle );
+	g_object_unref ( source->cancel );
+
+	free ( source );
+}
+
+static void image_svg_entry_free ( SvgEntry *entry )
+{
+	cairo_surface_destroy ( entry->surface );
+
+	free ( entry );
+}
+
+static void image_svg_done_free ( SvgDone *done )
+{
+	if ( done->surface ) cairo_surface_destroy ( done->surface );
+
+	image_svg_source_unref ( done->source );
+
+	free ( done );
+}
+
+static void image_svg_insert ( ImageSvg *svg, uint64_t key, cairo_surface_t *surface )
+{
+	SvgEntry *entry = g_new0 ( SvgEntry, 1 );
+
+	entry->key = key;
+	entry->surface = surface;
+	entry->link.data = entry;
+
+	g_hash_table_insert ( svg->cache, &entry->key, entry );
+	g_queue_push_head_link ( &svg->lru, &entry->link );
+
+	svg->bytes += SVG_BYTES;
+
+	while ( svg->bytes > svg->max_bytes && svg->lru.length > 1 )
+	{
+		SvgEntry *old = g_queue_peek_tail ( &svg->lru );
+
+		g_queue_unlink ( &svg->lru, &old->link );
+		g_hash_table_remove ( svg->cache, &old->key );
+
+		svg->bytes -= SVG_BYTES;
+	}
+}
+
+static gboolean image_svg_done ( ImageSvg *svg )
+{
+	g_mutex_lock ( &svg->lock );
+
+	GSList *list = g_slist_reverse ( svg->done );
+
+	svg->done = NULL;
+	svg->src_done = 0;
+
+	g_mutex_unlock ( &svg->lock );
+
+	gboolean update = FALSE;
+
+	GSList *l = NULL; for ( l = list; l; l = l->next )
+	{
+		SvgDone *done = l->data;
+
+		if ( done->source != svg->source ) continue;
+
+		if ( done->overview )
+		{
+			if ( svg->overview ) cairo_surface_destroy ( svg->overview );
+
+			svg->overview = done->surface;
+			done->surface = NULL;
+		}
+		else
+		{
+			g_hash_table_remove ( svg->pending, &done->key );
+
+			if ( done->surface && !g_hash_table_contains ( svg->cache, &done->key ) )
+			{
+				image_svg_insert ( svg, done->key, done->surface );
+
+				done->surface = NULL;
+			}
+		}
+
+		update = TRUE;
+	}
+
+	g_slist_free_full ( list, (GDestroyNotify)image_svg_done_free );
+
+	if ( update && svg->func ) svg->func ( svg->data );
+
+	return G_SOURCE_REMOVE;
+}
+
+static void image_svg_post ( SvgJob *job, cairo_surface_t *surface )
+{
+	ImageSvg *svg = job->source->svg;
+
+	SvgDone *done = g_new0 ( SvgDone, 1 );
+
+	done->source = image_svg_source_ref ( job->source );
+	done->key = job->key;
+	done->surface = surface;
+	done->overview = job->overview;
+
+	g_mutex_lock ( &svg->lock );
+
+	svg->done = g_slist_prepend ( svg->done, done );
+
+	if ( !svg->src_done ) svg->src_done = g_idle_add ( (GSourceFunc)image_svg_done, svg );
+
+	g_mutex_unlock ( &svg->lock );
+}
+
+/* The document laid out at width x height times zoom, shifted so the tile sits at the origin */
+static cairo_surface_t * image_svg_render ( SvgSource *source, double zoom, double x, double y, int w, int h )
+{
+	cairo_surface_t *surface = cairo_image_surface_create ( CAIRO_FORMAT_ARGB32, w, h );
+
+	if ( cairo_surface_status ( surface ) != CAIRO_STATUS_SUCCESS ) { cairo_surface_destroy ( surface ); return NULL; }
+
+	cairo_t *cr = cairo_create ( surface );
+
+	RsvgRectangle viewport = { -x, -y, source->width * zoom, source->height * zoom };
+
+	gboolean ok = rsvg_handle_render_document ( source->handle, cr, &viewport, NULL );
+
+	cairo_destroy ( cr );
+
+	if ( !ok ) { cairo_surface_destroy ( surface ); return NULL; }
+
+	return surface;
+}
+
+/* A tile of a zoom the view has left is dropped unrendered */
+static void image_svg_thread ( SvgJob *job, G_GNUC_UNUSED ImageSvg *svg )
+{
+	SvgSource *source = job->source;
+
+	cairo_surface_t *surface = NULL;
+
+	gboolean stale = ( !job->overview && (uint)( job->key >> 40 ) != ( (uint)g_atomic_int_get ( &source->zoom_id ) & 0xffffff ) );
+
+	if ( !g_cancellable_is_cancelled ( source->cancel ) && !stale )
+	{
+		if ( job->overview )
+		{
+			int w = MAX ( 1, (int)( source->width  * job->zoom + 0.5 ) );
+			int h = MAX ( 1, (int)( source->height * job->zoom + 0.5 ) );
+
+			surface = image_svg_render ( source, job->zoom, 0, 0, w, h );
+		}
+		else
+		{
+			uint ty = (uint)( job->key >> 20 ) & 0xfffff;
+			uint tx = (uint)job->key & 0xfffff;
+
+			surface = image_svg_render ( source, job->zoom, tx * SVG_TILE, ty * SVG_TILE, SVG_TILE, SVG_TILE );
+		}
+	}
+
+	if ( !g_cancellable_is_cancelled ( source->cancel ) ) image_svg_post ( job, surface );
+	else if ( surface ) cairo_surface_destroy ( surface );
+
+	image_svg_source_unref ( source );
+
+	free ( job );
+}
+
+static void image_svg_push ( ImageSvg *svg, uint64_t key, double zoom, gboolean overview )
+{
+	SvgJob *job = g_new0 ( SvgJob, 1 );
+
+	job->source = image_svg_source_ref ( svg->source );
+	job->key = key;
+	job->zoom = zoom;
+	job->overview = overview;
+
+	g_thread_pool_push ( svg->pool, job, NULL );
+}
+
+/* Each zoom the view renders at gets an id; the last SVG_ZOOMS are remembered */
+static uint image_svg_zoom_id ( ImageSvg *svg, double zoom )
+{
+	uint8_t c = 0; for ( c = 0; c < SVG_ZOOMS; c++ )
+		if ( svg->zoom_id_n[c] && svg->zoom_n[c] == zoom ) return svg->zoom_id_n[c];
+
+	c = (uint8_t)( svg->zoom_next % SVG_ZOOMS );
+
+	svg->zoom_n[c] = zoom;
+	svg->zoom_id_n[c] = ++svg->zoom_next;
+
+	return svg->zoom_id_n[c];
+}
+
+void image_svg_close ( ImageSvg *svg )
+{
+	if ( !svg->source ) return;
+
+	g_cancellable_cancel ( svg->source->cancel );
+
+	image_svg_source_unref ( svg->source );
+
+	svg->source = NULL;
+
+	if ( svg->overview ) cairo_surface_destroy ( svg->overview );
+
+	svg->overview = NULL;
+
+	g_queue_init ( &svg->lru );
+	g_hash_table_remove_all ( svg->cache );
+	g_hash_table_remove_all ( svg->pending );
+
+	svg->bytes = 0;
+}
+
+/* width x height is the size at zoom 1 */
+gboolean image_svg_open ( ImageSvg *svg, const char *path, int width, int height )
+{
+	image_svg_close ( svg );
+
+	if ( width <= 0 || height <= 0 ) return FALSE;
+
+	ImageLoad load = { 0 };
+	GError *error = NULL;
+
+	GBytes *bytes = image_load_bytes ( path, &load, &error );
+
+	gsize len = 0;
+	const uint8_t *data = ( bytes ) ? g_bytes_get_data ( bytes, &len ) : NULL;
+
+	RsvgHandle *handle = ( data ) ? rsvg_handle_new_from_data ( data, len, &error ) : NULL;
+
+	if ( bytes ) g_bytes_unref ( bytes );
+
+	if ( !handle )
+	{
+		g_warning ( "%s:: %s ", __func__, ( error ) ? error->message : path );
+
+		if ( error ) g_error_free ( error );
+
+		return FALSE;
+	}
+
+	SvgSource *source = g_new0 ( SvgSource, 1 );
+
+	source->ref = 1;
+	source->handle = handle;
+	source->width  = width;
+	source->height = height;
+	source->cancel = g_cancellable_new ();
+	source->svg    = svg;
+
+	svg->source = source;
+
+	image_svg_push ( svg, 0, (double)SVG_OVERVIEW / MAX ( width, height ), TRUE );
+
+	return TRUE;
+}
+
+gboolean image_svg_is_open ( ImageSvg *svg )
+{
+	return ( svg->source != NULL );
+}
+
+cairo_surface_t * image_svg_get_overview ( ImageSvg *svg )
+{
+	return svg->overview;
+}
+
+/* Borrowed surface, or NULL while it renders; without request only what is cached */
+cairo_surface_t * image_svg_get ( ImageSvg *svg, double zoom, uint tx, uint ty, gboolean request )
+{
+	if ( !svg->source || zoom <= 0 ) return NULL;
+
+	uint zoom_id = image_svg_zoom_id ( svg, zoom );
+
+	uint64_t key = image_svg_key ( zoom_id, tx, ty );
+
+	SvgEntry *entry = g_hash_table_lookup ( svg->cache, &key );
+
+	if ( entry )
+	{
+		g_queue_unlink ( &svg->lru, &entry->link );
+		g_queue_push_head_link ( &svg->lru, &entry->link );
+
+		return entry->surface;
+	}
+
+	if ( !request ) return NULL;
+
+	g_atomic_int_set ( &svg->source->zoom_id, (int)zoom_id );
+
+	if ( g_hash_table_contains ( svg->pending, &key ) ) return NULL;
+
+	uint64_t *pkey = g_new ( uint64_t, 1 );
+	*pkey = key;
+
+	g_hash_table_add ( svg->pending, pkey );
+
+	image_svg_push ( svg, key, zoom, FALSE );
+
+	return NULL;
+}
+
+void image_svg_free ( ImageSvg *svg )
+{
+	image_svg_close ( svg );
+
+	g_thread_pool_free ( svg->pool, FALSE, TRUE );
+
+	g_mutex_lock ( &svg->lock );
+
+	if ( svg->src_done ) g_source_remove ( svg->src_done );
+
+	g_slist_free_full ( svg->done, (GDestroyNotify)image_svg_done_free );
+
+	g_mutex_unlock ( &svg->lock );
+
+	g_hash_table_unref ( svg->cache );
+	g_hash_table_unref ( svg->pending );
+
+	g_mutex_clear ( &svg->lock );
+
+	free ( svg );
+}
+
+ImageSvg * image_svg_new ( uint64_t max_bytes, SvgFunc func, gpointer data )
+{
+	ImageSvg *svg = g_new0 ( ImageSvg, 1 );
+
+	g_mutex_init ( &svg->lock );
+
+	svg->max_bytes = max_bytes;
+	svg->func = func;
+	svg->data = data;
+
+	svg->cache   = g_hash_table_new_full ( g_int64_hash, g_int64_equal, NULL, (GDestroyNotify)image_svg_entry_free );
+	svg->pending = g_hash_table_new_full ( g_int64_hash, g_int64_equal, free, NULL );
+
+	g_queue_init ( &svg->lru );
+
+	svg->pool = g_thread_pool_new ( (GFunc)image_svg_thread, svg, 1, FALSE, NULL );
+
+	return svg;
+}
+
+#else
+
+/* Built without librsvg: SVGs are rasterised by the gdk-pixbuf loader like any other image */
+
+struct _ImageSvg
+{
+	SvgFunc func;
+	gpointer data;
+};
+
+gboolean image_svg_open ( G_GNUC_UNUSED ImageSvg *svg, G_GNUC_UNUSED const char *path, G_GNUC_UNUSED int width, G_GNUC_UNUSED int height )
+{
+	return FALSE;
+}
+
+void image_svg_close ( G_GNUC_UNUSED ImageSvg *svg ) { }
+
+gboolean image_svg_is_open ( G_GNUC_UNUSED ImageSvg *svg )
+{
+	return FALSE;
+}
+
+cairo_surface_t * image_svg_get_overview ( G_GNUC_UNUSED ImageSvg *svg )
+{
+	return NULL;
+}
+
+cairo_surface_t * image_svg_get ( G_GNUC_UNUSED ImageSvg *svg, G_GNUC_UNUSED double zoom, G_GNUC_UNUSED uint tx, G_GNUC_UNUSED uint ty, G_GNUC_UNUSED gboolean request )
+{
+	return NULL;
+}
+
+void image_svg_free ( ImageSvg *svg )
+{
+	free ( svg );
+}
+
+ImageSvg * image_svg_new ( G_GNUC_UNUSED uint64_t max_bytes, SvgFunc func, gpointer data )
+{
+	ImageSvg *svg = g_new0 ( ImageSvg, 1 );
+
+	svg->func = func;
+	svg->data = data;
+
+	return svg;
+}
+
+#endif
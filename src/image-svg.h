@@ -0,0 +1,32 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+#define SVG_TILE 256
+
+typedef struct _ImageSvg ImageSvg;
+
+typedef void ( *SvgFunc ) ( gpointer );
+
+ImageSvg * image_svg_new ( uint64_t, SvgFunc, gpointer );
+
+void image_svg_free ( ImageSvg * );
+
+gboolean image_svg_open ( ImageSvg *, const char *, int, int );
+
+void image_svg_close ( ImageSvg * );
+
+gboolean image_svg_is_open ( ImageSvg * );
+
+cairo_surface_t * image_svg_get_overview ( ImageSvg * );
+
+cairo_surface_t * image_svg_get ( ImageSvg *, double, uint, uint, gboolean );
@@ -0,0 +1,162 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-thumb-cache.h"
+#include "image-load.h"
+#include "image-ops.h"
+
+#include <glib/gstdio.h>
+
+/* Thumbnail Managing Standard: $XDG_CACHE_HOME/thumbnails/<size>/<md5 of URI>.png */
+
+typedef struct _ThumbDir ThumbDir;
+
+struct _ThumbDir
+{
+	const char *name;
+	uint16_t size;
+};
+
+static const ThumbDir thumb_dir_n[] =
+{
+	{ "normal",    128 },
+	{ "large",     256 },
+	{ "x-large",   512 },
+	{ "xx-large", 1024 }
+};
+
+static char * image_thumb_cache_path ( const char *md5, uint8_t num )
+{
+	g_autofree char *name = g_strconcat ( md5, ".png", NULL );
+
+	return g_build_filename ( g_get_user_cache_dir (), "thumbnails", thumb_dir_n[num].name, name, NULL );
+}
+
+static GdkPixbuf * image_thumb_cache_scale ( GdkPixbuf *pixbuf, uint16_t size )
+{
+	int w = gdk_pixbuf_get_width  ( pixbuf );
+	int h = gdk_pixbuf_get_height ( pixbuf );
+
+	if ( w <= size && h <= size ) return pixbuf;
+
+	double scale = (double)size / MAX ( w, h );
+
+	GdkPixbuf *pb_scale = image_ops_scale ( pixbuf, MAX ( 1, (int)( w * scale + 0.5 ) ), MAX ( 1, (int)( h * scale + 0.5 ) ), OPS_BOX );
+
+	g_object_unref ( pixbuf );
+
+	return pb_scale;
+}
+
+/* Valid only for the same URI and modification time as the original */
+static GdkPixbuf * image_thumb_cache_load ( const char *cache_path, const char *uri, int64_t mtime )
+{
+	image_load_stat ( STAT_OPEN );
+
+	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file ( cache_path, NULL );
+
+	if ( !pixbuf ) return NULL;
+
+	const char *t_uri   = gdk_pixbuf_get_option ( pixbuf, "tEXt::Thumb::URI"   );
+	const char *t_mtime = gdk_pixbuf_get_option ( pixbuf, "tEXt::Thumb::MTime" );
+
+	if ( t_uri && t_mtime && g_str_equal ( t_uri, uri ) && g_ascii_strtoll ( t_mtime, NULL, 10 ) == mtime ) return pixbuf;
+
+	g_object_unref ( pixbuf );
+
+	return NULL;
+}
+
+/* Written to a temporary file in the same directory and renamed over the old one */
+static void image_thumb_cache_save ( GdkPixbuf *pixbuf, const char *cache_path, const char *uri, int64_t mtime, ImageLoad *load )
+{
+	g_autofree char *dir = g_path_get_dirname ( cache_path );
+
+	image_load_stat ( STAT_STAT );
+
+	if ( g_mkdir_with_parents ( dir, 0700 ) != 0 ) return;
+
+	g_autofree char *tmp = g_strconcat ( cache_path, ".XXXXXX", NULL );
+
+	image_load_stat ( STAT_OPEN );
+
+	int fd = g_mkstemp ( tmp );
+
+	if ( fd < 0 ) return;
+
+	g_close ( fd, NULL );
+
+	char s_mtime[32], s_size[32], s_w[16], s_h[16];
+
+	sprintf ( s_mtime, "%" G_GINT64_FORMAT, mtime );
+	sprintf ( s_size,  "%" G_GUINT64_FORMAT, load->size );
+	sprintf ( s_w, "%d", load->org_w );
+	sprintf ( s_h, "%d", load->org_h );
+
+	char *keys[]   = { "tEXt::Thumb::URI", "tEXt::Thumb::MTime", "tEXt::Thumb::Size", "tEXt::Thumb::Image::Width", "tEXt::Thumb::Image::Height", "tEXt::Software", NULL };
+	char *values[] = { (char *)uri, s_mtime, s_size, s_w, s_h, "Image-Gtk", NULL };
+
+	if ( gdk_pixbuf_savev ( pixbuf, tmp, "png", keys, values, NULL ) && g_rename ( tmp, cache_path ) == 0 ) return;
+
+	g_unlink ( tmp );
+}
+
+/* Cache first: a hit costs one small PNG decode, a miss decodes the image once at the cache size and stores it.
+   mtime and file size come from the directory enumeration, nothing is stat'ed here. */
+GdkPixbuf * image_thumb_cache_get ( const char *path, int64_t mtime, uint64_t file_size, uint16_t size )
+{
+	g_autofree char *uri = g_filename_to_uri ( path, NULL, NULL );
+
+	if ( !uri ) return NULL;
+
+	g_autofree char *md5 = g_compute_checksum_for_string ( G_CHECKSUM_MD5, uri, -1 );
+
+	uint8_t num = ( size <= 128 ) ? 0 : ( size <= 256 ) ? 1 : ( size <= 512 ) ? 2 : 3;
+
+	uint8_t c = 0; for ( c = num; c < G_N_ELEMENTS ( thumb_dir_n ); c++ )
+	{
+		g_autofree char *cache_path = image_thumb_cache_path ( md5, c );
+
+		GdkPixbuf *pixbuf = image_thumb_cache_load ( cache_path, uri, mtime );
+
+		if ( pixbuf ) return image_thumb_cache_scale ( pixbuf, size );
+	}
+
+	ImageLoad load = { 0 };
+	load.mtime = mtime;
+	load.size  = file_size;
+
+	GdkPixbuf *pixbuf = NULL;
+
+	if ( image_load_probe ( path, &load, NULL ) ) pixbuf = image_load_decode ( path, thumb_dir_n[num].size, thumb_dir_n[num].size, &load, NULL );
+
+	if ( !pixbuf ) return NULL;
+
+	if ( load.orientation > 1 )
+	{
+		GdkPixbuf *pb_orient = image_ops_orient ( pixbuf, load.orientation );
+
+		g_object_unref ( pixbuf );
+
+		if ( !pb_orient ) return NULL;
+
+		pixbuf = pb_orient;
+	}
+
+	g_autofree char *root = g_build_filename ( g_get_user_cache_dir (), "thumbnails", NULL );
+
+	if ( !g_str_has_prefix ( path, root ) )
+	{
+		g_autofree char *cache_path = image_thumb_cache_path ( md5, num );
+
+		image_thumb_cache_save ( pixbuf, cache_path, uri, load.mtime, &load );
+	}
+
+	return image_thumb_cache_scale ( pixbuf, size );
+}
@@ -0,0 +1,277 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-thumb.h"
+
+typedef struct _ThumbWorker ThumbWorker;
+
+struct _ThumbWorker
+{
+	GMutex lock;
+	GQueue jobs;
+
+	GThread *thread;
+	ImageThumbPool *pool;
+};
+
+/*
+* One pool for the application, so windows share the workers instead of competing for the disk.
+* One deque per worker, spread round-robin on push: the owner takes jobs from the head, an idle
+* worker steals from the head of the others as well, since the head holds the most urgent jobs.
+* Finished jobs go to a lock-free stack of the client ( a window ) that only its main loop drains.
+*/
+struct _ImageThumbPool
+{
+	uint n_workers;
+	ThumbWorker *workers;
+
+	GMutex idle_lock;
+	GCond  idle_cond;
+
+	int pending;
+	uint next;
+	gboolean quit;
+
+	ThumbFunc run;
+	gpointer data;
+};
+
+/* Jobs in flight hold a reference: a window can close with work still queued */
+struct _ImageThumbClient
+{
+	int ref;
+
+	ThumbJob *results;
+};
+
+static ThumbJob * image_thumb_worker_pop ( ThumbWorker *worker )
+{
+	g_mutex_lock ( &worker->lock );
+
+	ThumbJob *job = g_queue_pop_head ( &worker->jobs );
+
+	g_mutex_unlock ( &worker->lock );
+
+	return job;
+}
+
+static ThumbJob * image_thumb_pool_take ( ThumbWorker *worker )
+{
+	ImageThumbPool *pool = worker->pool;
+
+	ThumbJob *job = image_thumb_worker_pop ( worker );
+
+	uint own = (uint)( worker - pool->workers );
+
+	uint c = 1; for ( c = 1; !job && c < pool->n_workers; c++ )
+		job = image_thumb_worker_pop ( &pool->workers[( own + c ) % pool->n_workers] );
+
+	if ( job ) g_atomic_int_dec_and_test ( &pool->pending );
+
+	return job;
+}
+
+static void image_thumb_client_unref ( ImageThumbClient *client )
+{
+	if ( !g_atomic_int_dec_and_test ( &client->ref ) ) return;
+
+	ThumbJob *job = image_thumb_client_drain ( client );
+
+	while ( job ) { ThumbJob *next = job->next; image_thumb_job_free ( job ); job = next; }
+
+	free ( client );
+}
+
+/* Any number of workers push, nobody pops single jobs: no ABA, no lock */
+static void image_thumb_pool_result ( ThumbJob *job )
+{
+	ImageThumbClient *client = job->client;
+
+	job->client = NULL;
+
+	ThumbJob *head = NULL;
+
+	do
+	{
+		head = g_atomic_pointer_get ( &client->results );
+		job->next = head;
+	}
+	while ( !g_atomic_pointer_compare_and_exchange ( &client->results, head, job ) );
+
+	image_thumb_client_unref ( client );
+}
+
+/* Takes all finished jobs of the client at once, oldest first, linked by job->next */
+ThumbJob * image_thumb_client_drain ( ImageThumbClient *client )
+{
+	ThumbJob *head = NULL, *list = NULL;
+
+	do
+		head = g_atomic_pointer_get ( &client->results );
+	while ( head && !g_atomic_pointer_compare_and_exchange ( &client->results, head, NULL ) );
+
+	while ( head )
+	{
+		ThumbJob *next = head->next;
+
+		head->next = list;
+		list = head;
+
+		head = next;
+	}
+
+	return list;
+}
+
+static gpointer image_thumb_pool_thread ( ThumbWorker *worker )
+{
+	ImageThumbPool *pool = worker->pool;
+
+	while ( TRUE )
+	{
+		ThumbJob *job = image_thumb_pool_take ( worker );
+
+		if ( !job )
+		{
+			g_mutex_lock ( &pool->idle_lock );
+
+			while ( !pool->quit && g_atomic_int_get ( &pool->pending ) == 0 ) g_cond_wait ( &pool->idle_cond, &pool->idle_lock );
+
+			gboolean quit = pool->quit;
+
+			g_mutex_unlock ( &pool->idle_lock );
+
+			if ( quit ) break;
+
+			continue;
+		}
+
+		if ( !g_cancellable_is_cancelled ( job->cancel ) ) pool->run ( job, pool->data );
+
+		image_thumb_pool_result ( job );
+	}
+
+	return NULL;
+}
+
+ImageThumbClient * image_thumb_client_new ( void )
+{
+	ImageThumbClient *client = g_new0 ( ImageThumbClient, 1 );
+
+	client->ref = 1;
+
+	return client;
+}
+
+/* The owner lets go; finished jobs that arrive later are freed with the last one */
+void image_thumb_client_free ( ImageThumbClient *client )
+{
+	image_thumb_client_unref ( client );
+}
+
+/* Main thread only ( next is not atomic ) */
+void image_thumb_pool_push ( ImageThumbPool *pool, ImageThumbClient *client, ThumbJob *job )
+{
+	ThumbWorker *worker = &pool->workers[pool->next++ % pool->n_workers];
+
+	g_atomic_int_inc ( &client->ref );
+
+	job->client = client;
+
+	g_atomic_int_inc ( &pool->pending );
+
+	g_mutex_lock ( &worker->lock );
+	g_queue_push_tail ( &worker->jobs, job );
+	g_mutex_unlock ( &worker->lock );
+
+	g_mutex_lock ( &pool->idle_lock );
+
+	g_cond_signal ( &pool->idle_cond );
+
+	g_mutex_unlock ( &pool->idle_lock );
+}
+
+ThumbJob * image_thumb_job_new ( const char *path, uint16_t size, gboolean is_link, GCancellable *cancel )
+{
+	ThumbJob *job = g_new0 ( ThumbJob, 1 );
+
+	job->path = g_strdup ( path );
+	job->size = size;
+	job->is_link = is_link;
+	job->cancel = g_object_ref ( cancel );
+
+	return job;
+}
+
+void image_thumb_job_free ( ThumbJob *job )
+{
+	if ( job->pixbuf ) g_object_unref ( job->pixbuf );
+
+	g_object_unref ( job->cancel );
+
+	free ( job->path );
+	free ( job );
+}
+
+void image_thumb_pool_free ( ImageThumbPool *pool )
+{
+	g_mutex_lock ( &pool->idle_lock );
+
+	pool->quit = TRUE;
+	g_cond_broadcast ( &pool->idle_cond );
+
+	g_mutex_unlock ( &pool->idle_lock );
+
+	uint c = 0; for ( c = 0; c < pool->n_workers; c++ )
+	{
+		ThumbWorker *worker = &pool->workers[c];
+
+		g_thread_join ( worker->thread );
+
+		ThumbJob *job = NULL;
+		while ( ( job = g_queue_pop_head ( &worker->jobs ) ) ) image_thumb_pool_result ( job );
+
+		g_mutex_clear ( &worker->lock );
+	}
+
+	g_mutex_clear ( &pool->idle_lock );
+	g_cond_clear  ( &pool->idle_cond );
+
+	free ( pool->workers );
+	free ( pool );
+}
+
+/* run is called on a worker for every job that is not cancelled; every job comes back through the drain of its client */
+ImageThumbPool * image_thumb_pool_new ( ThumbFunc run, gpointer data )
+{
+	ImageThumbPool *pool = g_new0 ( ImageThumbPool, 1 );
+
+	pool->run  = run;
+	pool->data = data;
+
+	pool->n_workers = MAX ( 1, g_get_num_processors () );
+	pool->workers = g_new0 ( ThumbWorker, pool->n_workers );
+
+	g_mutex_init ( &pool->idle_lock );
+	g_cond_init  ( &pool->idle_cond );
+
+	uint c = 0; for ( c = 0; c < pool->n_workers; c++ )
+	{
+		ThumbWorker *worker = &pool->workers[c];
+
+		worker->pool = pool;
+
+		g_mutex_init ( &worker->lock );
+		g_queue_init ( &worker->jobs );
+
+		worker->thread = g_thread_new ( "thumb", (GThreadFunc)image_thumb_pool_thread, worker );
+	}
+
+	return pool;
+}
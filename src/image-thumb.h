@@ -0,0 +1,56 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+typedef struct _ThumbJob ThumbJob;
+
+typedef struct _ImageThumbClient ImageThumbClient;
+
+struct _ThumbJob
+{
+	char *path;
+
+	uint16_t size;
+	gboolean is_link;
+
+	int64_t mtime;
+	uint64_t file_size;
+
+	uint index;
+	uint serial;
+
+	GdkPixbuf *pixbuf;
+	GCancellable *cancel;
+	ImageThumbClient *client;
+
+	ThumbJob *next;
+};
+
+typedef void ( *ThumbFunc ) ( ThumbJob *, gpointer );
+
+typedef struct _ImageThumbPool ImageThumbPool;
+
+ImageThumbPool * image_thumb_pool_new ( ThumbFunc, gpointer );
+
+void image_thumb_pool_free ( ImageThumbPool * );
+
+void image_thumb_pool_push ( ImageThumbPool *, ImageThumbClient *, ThumbJob * );
+
+ImageThumbClient * image_thumb_client_new ( void );
+
+void image_thumb_client_free ( ImageThumbClient * );
+
+ThumbJob * image_thumb_client_drain ( ImageThumbClient * );
+
+ThumbJob * image_thumb_job_new ( const char *, uint16_t, gboolean, GCancellable * );
+
+void image_thumb_job_free ( ThumbJob * );
@@ -0,0 +1,591 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-tiles.h"
+#include "image-load.h"
+#include "image-ops.h"
+
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#define TILE_BYTES ( TILE_SIZE * TILE_SIZE * 4 )
+#define TILE_OVERVIEW ( TILE_SIZE * 4 )
+#define TILE_MAX_PIXELS ( 8192 * 8192 )
+
+/*
+* gdk-pixbuf has no region decode: the image is decoded once on a worker,
+* cut into premultiplied ARGB32 tiles for every mip level and written to an
+* unlinked file in the user cache. Tiles are read back on demand into a
+* bounded LRU of cairo surfaces, so resident memory does not grow with the image.
+*
+* The build itself holds the decode: a loader keeps the whole image in one pixbuf,
+* rows streamed out of it would not lower that. Above TILE_MAX_PIXELS the pyramid
+* starts at the first level below the limit ( base ), decoded at that size; the build
+* then peaks at about 1.25 x 256 MiB of RAM and writes 4/3 x 256 MiB to the cache.
+* JPEG scales in the DCT; loaders that cannot scale still hold the full image briefly.
+*/
+
+typedef struct _TileSource TileSource;
+
+struct _TileSource
+{
+	int ref;
+	int fd;
+
+	char *path;
+
+	int width;
+	int height;
+
+	uint8_t base;
+	uint8_t levels;
+
+	int level_w[TILE_LEVELS];
+	int level_h[TILE_LEVELS];
+	uint64_t offset[TILE_LEVELS];
+
+	GCancellable *cancel;
+	ImageTiles *tiles;
+};
+
+enum done_enm
+{
+	DONE_TILE,
+	DONE_OVERVIEW,
+	DONE_BUILT
+};
+
+typedef struct _TileDone TileDone;
+
+struct _TileDone
+{
+	enum done_enm type;
+
+	TileSource *source;
+
+	uint64_t key;
+	cairo_surface_t *surface;
+};
+
+typedef struct _TileEntry TileEntry;
+
+struct _TileEntry
+{
+	uint64_t key;
+	cairo_surface_t *surface;
+
+	GList link;
+};
+
+typedef struct _TileJob TileJob;
+
+struct _TileJob
+{
+	TileSource *source;
+
+	gboolean build;
+	uint64_t key;
+};
+
+struct _ImageTiles
+{
+	GMutex lock;
+
+	GThreadPool *pool;
+
+	TileSource *source;
+	cairo_surface_t *overview;
+	gboolean built;
+
+	GHashTable *cache;
+	GHashTable *pending;
+	GQueue lru;
+
+	uint64_t bytes;
+	uint64_t max_bytes;
+
+	GSList *done;
+	uint src_done;
+
+	TilesFunc func;
+	gpointer data;
+};
+
+static inline uint64_t image_tiles_key ( uint8_t level, uint tx, uint ty )
+{
+	return (uint64_t)level << 48 | (uint64_t)ty << 24 | tx;
+}
+
+static TileSource * image_tiles_source_ref ( TileSource *source )
+{
+	g_atomic_int_inc ( &source->ref );
+
+	return source;
+}
+
+static void image_tiles_source_unref ( TileSource *source )
+{
+	if ( !g_atomic_int_dec_and_test ( &source->ref ) ) return;
+
+	if ( source->fd != -1 ) close ( source->fd );
+
+	g_object_unref ( source->cancel );
+
+	free ( source->path );
+	free ( source );
+}
+
+static int image_tiles_source_fd ( void )
+{
+	g_autofree char *dir = g_build_filename ( g_get_user_cache_dir (), "image-gtk", NULL );
+	g_autofree char *tmpl = g_build_filename ( dir, "tiles-XXXXXX", NULL );
+
+	int fd = ( g_mkdir_with_parents ( dir, 0700 ) == 0 ) ? g_mkstemp ( tmpl ) : -1;
+
+	if ( fd != -1 ) g_unlink ( tmpl );
+
+	return fd;
+}
+
+static gboolean image_tiles_done ( ImageTiles * );
+
+static void image_tiles_post ( TileSource *source, enum done_enm type, uint64_t key, cairo_surface_t *surface )
+{
+	ImageTiles *tiles = source->tiles;
+
+	TileDone *done = g_new0 ( TileDone, 1 );
+
+	done->type = type;
+	done->source = image_tiles_source_ref ( source );
+	done->key = key;
+	done->surface = surface;
+
+	g_mutex_lock ( &tiles->lock );
+
+	tiles->done = g_slist_prepend ( tiles->done, done );
+
+	if ( !tiles->src_done ) tiles->src_done = g_idle_add ( (GSourceFunc)image_tiles_done, tiles );
+
+	g_mutex_unlock ( &tiles->lock );
+}
+
+static gboolean image_tiles_write_level ( TileSource *source, uint8_t level, GdkPixbuf *pixbuf, uint8_t *buf )
+{
+	int lw = source->level_w[level];
+	int lh = source->level_h[level];
+
+	uint ntx = (uint)( lw + TILE_SIZE - 1 ) / TILE_SIZE;
+	uint nty = (uint)( lh + TILE_SIZE - 1 ) / TILE_SIZE;
+
+	uint ty = 0; for ( ty = 0; ty < nty; ty++ )
+	{
+		if ( g_cancellable_is_cancelled ( source->cancel ) ) return FALSE;
+
+		uint tx = 0; for ( tx = 0; tx < ntx; tx++ )
+		{
+			int x = (int)tx * TILE_SIZE;
+			int y = (int)ty * TILE_SIZE;
+
+			int tw = MIN ( TILE_SIZE, lw - x );
+			int th = MIN ( TILE_SIZE, lh - y );
+
+			if ( tw < TILE_SIZE || th < TILE_SIZE ) memset ( buf, 0, TILE_BYTES );
+
+			image_ops_to_argb32 ( pixbuf, x, y, tw, th, buf, TILE_SIZE * 4 );
+
+			uint64_t offset = source->offset[level] + ( (uint64_t)ty * ntx + tx ) * TILE_BYTES;
+
+			if ( pwrite ( source->fd, buf, TILE_BYTES, (off_t)offset ) != TILE_BYTES ) return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void image_tiles_build ( TileSource *source )
+{
+	int64_t t = g_get_monotonic_time ();
+
+	ImageLoad load = { 0 };
+	GError *error = NULL;
+	GdkPixbuf *pixbuf = NULL;
+
+	int bw = source->level_w[source->base];
+	int bh = source->level_h[source->base];
+
+	if ( source->fd != -1 && image_load_probe ( source->path, &load, &error ) )
+		pixbuf = image_load_decode_stream ( source->path, ( source->base ) ? bw : 0, ( source->base ) ? bh : 0, &load, source->cancel, NULL, NULL, &error );
+
+	if ( pixbuf && ( load.org_w != source->width || load.org_h != source->height ) ) g_clear_object ( &pixbuf );
+
+	/* The loader rounds its own way */
+	if ( pixbuf && ( gdk_pixbuf_get_width ( pixbuf ) != bw || gdk_pixbuf_get_height ( pixbuf ) != bh ) )
+	{
+		GdkPixbuf *pb_base = image_ops_scale ( pixbuf, bw, bh, OPS_BOX );
+
+		g_object_unref ( pixbuf );
+
+		pixbuf = pb_base;
+	}
+
+	if ( !pixbuf )
+	{
+		g_warning ( "%s:: %s ", __func__, ( error ) ? error->message : source->path );
+
+		if ( error ) g_error_free ( error );
+
+		image_tiles_post ( source, DONE_BUILT, FALSE, NULL );
+
+		return;
+	}
+
+	double scale = (double)TILE_OVERVIEW / MAX ( source->width, source->height );
+
+	GdkPixbuf *pb_view = image_ops_scale ( pixbuf, MAX ( 1, (int)( source->width * scale ) ), MAX ( 1, (int)( source->height * scale ) ), OPS_BOX );
+
+	if ( pb_view ) image_tiles_post ( source, DONE_OVERVIEW, 0, image_ops_surface ( pb_view ) );
+
+	if ( pb_view ) g_object_unref ( pb_view );
+
+	uint8_t *buf = g_malloc0 ( TILE_BYTES );
+
+	gboolean ok = TRUE;
+
+	uint8_t level = 0; for ( level = source->base; ok && level < source->levels; level++ )
+	{
+		if ( level > source->base )
+		{
+			GdkPixbuf *pb_half = image_ops_scale ( pixbuf, source->level_w[level], source->level_h[level], OPS_BOX );
+
+			g_object_unref ( pixbuf );
+
+			pixbuf = pb_half;
+		}
+
+		ok = ( pixbuf && image_tiles_write_level ( source, level, pixbuf, buf ) );
+	}
+
+	if ( pixbuf ) g_object_unref ( pixbuf );
+
+	free ( buf );
+
+	image_tiles_post ( source, DONE_BUILT, ok, NULL );
+
+	g_debug ( "%s:: %d x %d, levels %u - %u, %s, %.2f ms :: %s", __func__, source->width, source->height, source->base, source->levels - 1,
+		( ok ) ? "done" : "stopped", (double)( g_get_monotonic_time () - t ) / 1000, source->path );
+}
+
+static void image_tiles_fetch ( TileSource *source, uint64_t key )
+{
+	uint8_t level = (uint8_t)( key >> 48 );
+
+	uint ty = (uint)( key >> 24 ) & 0xffffff;
+	uint tx = (uint)key & 0xffffff;
+
+	uint ntx = (uint)( source->level_w[level] + TILE_SIZE - 1 ) / TILE_SIZE;
+
+	cairo_surface_t *surface = cairo_image_surface_create ( CAIRO_FORMAT_ARGB32, TILE_SIZE, TILE_SIZE );
+
+	uint64_t offset = source->offset[level] + ( (uint64_t)ty * ntx + tx ) * TILE_BYTES;
+
+	gboolean ok = ( cairo_surface_status ( surface ) == CAIRO_STATUS_SUCCESS && cairo_image_surface_get_stride ( surface ) == TILE_SIZE * 4 );
+
+	if ( ok ) cairo_surface_flush ( surface );
+
+	if ( ok ) ok = ( pread ( source->fd, cairo_image_surface_get_data ( surface ), TILE_BYTES, (off_t)offset ) == TILE_BYTES );
+
+	if ( ok ) cairo_surface_mark_dirty ( surface );
+
+	if ( !ok ) { cairo_surface_destroy ( surface ); surface = NULL; }
+
+	image_tiles_post ( source, DONE_TILE, key, surface );
+}
+
+static void image_tiles_thread ( TileJob *job, G_GNUC_UNUSED ImageTiles *tiles )
+{
+	if ( !g_cancellable_is_cancelled ( job->source->cancel ) )
+	{
+		if ( job->build ) image_tiles_build ( job->source ); else image_tiles_fetch ( job->source, job->key );
+	}
+
+	image_tiles_source_unref ( job->source );
+
+	free ( job );
+}
+
+static void image_tiles_push ( ImageTiles *tiles, gboolean build, uint64_t key )
+{
+	TileJob *job = g_new0 ( TileJob, 1 );
+
+	job->source = image_tiles_source_ref ( tiles->source );
+	job->build = build;
+	job->key = key;
+
+	g_thread_pool_push ( tiles->pool, job, NULL );
+}
+
+static void image_tiles_entry_free ( TileEntry *entry )
+{
+	cairo_surface_destroy ( entry->surface );
+
+	free ( entry );
+}
+
+static void image_tiles_insert ( ImageTiles *tiles, uint64_t key, cairo_surface_t *surface )
+{
+	TileEntry *entry = g_new0 ( TileEntry, 1 );
+
+	entry->key = key;
+	entry->surface = surface;
+	entry->link.data = entry;
+
+	g_hash_table_insert ( tiles->cache, &entry->key, entry );
+	g_queue_push_head_link ( &tiles->lru, &entry->link );
+
+	tiles->bytes += TILE_BYTES;
+
+	while ( tiles->bytes > tiles->max_bytes && tiles->lru.length > 1 )
+	{
+		TileEntry *old = g_queue_peek_tail ( &tiles->lru );
+
+		g_queue_unlink ( &tiles->lru, &old->link );
+		g_hash_table_remove ( tiles->cache, &old->key );
+
+		tiles->bytes -= TILE_BYTES;
+	}
+}
+
+static void image_tiles_done_free ( TileDone *done )
+{
+	if ( done->surface ) cairo_surface_destroy ( done->surface );
+
+	image_tiles_source_unref ( done->source );
+
+	free ( done );
+}
+
+static gboolean image_tiles_done ( ImageTiles *tiles )
+{
+	g_mutex_lock ( &tiles->lock );
+
+	GSList *list = g_slist_reverse ( tiles->done );
+
+	tiles->done = NULL;
+	tiles->src_done = 0;
+
+	g_mutex_unlock ( &tiles->lock );
+
+	gboolean update = FALSE;
+
+	GSList *l = NULL; for ( l = list; l; l = l->next )
+	{
+		TileDone *done = l->data;
+
+		if ( done->source != tiles->source ) continue;
+
+		if ( done->type == DONE_OVERVIEW && done->surface )
+		{
+			if ( tiles->overview ) cairo_surface_destroy ( tiles->overview );
+
+			tiles->overview = done->surface;
+			done->surface = NULL;
+		}
+
+		if ( done->type == DONE_BUILT ) tiles->built = (gboolean)done->key;
+
+		if ( done->type == DONE_TILE )
+		{
+			g_hash_table_remove ( tiles->pending, &done->key );
+
+			if ( done->surface && !g_hash_table_contains ( tiles->cache, &done->key ) )
+			{
+				image_tiles_insert ( tiles, done->key, done->surface );
+
+				done->surface = NULL;
+			}
+		}
+
+		update = TRUE;
+	}
+
+	g_slist_free_full ( list, (GDestroyNotify)image_tiles_done_free );
+
+	if ( update && tiles->func ) tiles->func ( tiles->data );
+
+	return G_SOURCE_REMOVE;
+}
+
+void image_tiles_close ( ImageTiles *tiles )
+{
+	if ( !tiles->source ) return;
+
+	g_cancellable_cancel ( tiles->source->cancel );
+
+	image_tiles_source_unref ( tiles->source );
+
+	tiles->source = NULL;
+	tiles->built = FALSE;
+
+	if ( tiles->overview ) cairo_surface_destroy ( tiles->overview );
+
+	tiles->overview = NULL;
+
+	g_queue_init ( &tiles->lru );
+	g_hash_table_remove_all ( tiles->cache );
+	g_hash_table_remove_all ( tiles->pending );
+
+	tiles->bytes = 0;
+}
+
+void image_tiles_open ( ImageTiles *tiles, const char *path, int width, int height )
+{
+	image_tiles_close ( tiles );
+
+	TileSource *source = g_new0 ( TileSource, 1 );
+
+	source->ref = 1;
+	source->fd  = image_tiles_source_fd ();
+	source->path = g_strdup ( path );
+	source->width  = width;
+	source->height = height;
+	source->cancel = g_cancellable_new ();
+	source->tiles  = tiles;
+
+	int lw = width, lh = height;
+	uint64_t offset = 0;
+
+	uint8_t level = 0; for ( level = 0; level < TILE_LEVELS; level++ )
+	{
+		source->level_w[level] = lw;
+		source->level_h[level] = lh;
+		source->offset[level]  = offset;
+
+		source->levels = level + 1;
+
+		if ( source->base == level && (uint64_t)lw * (uint64_t)lh > TILE_MAX_PIXELS ) source->base = level + 1;
+
+		if ( lw <= TILE_SIZE && lh <= TILE_SIZE ) break;
+
+		if ( level >= source->base ) offset += (uint64_t)( ( lw + TILE_SIZE - 1 ) / TILE_SIZE ) * (uint64_t)( ( lh + TILE_SIZE - 1 ) / TILE_SIZE ) * TILE_BYTES;
+
+		lw = MAX ( 1, lw / 2 );
+		lh = MAX ( 1, lh / 2 );
+	}
+
+	tiles->source = source;
+
+	image_tiles_push ( tiles, TRUE, 0 );
+}
+
+gboolean image_tiles_is_open ( ImageTiles *tiles, const char *path, int width, int height )
+{
+	TileSource *source = tiles->source;
+
+	if ( !source ) return FALSE;
+
+	if ( !path ) return TRUE;
+
+	return ( source->width == width && source->height == height && g_str_equal ( source->path, path ) );
+}
+
+/* The finest level that is not more detailed than the screen needs, and not finer than the base */
+uint8_t image_tiles_get_level ( ImageTiles *tiles, double zoom )
+{
+	if ( !tiles->source || zoom <= 0 ) return ( tiles->source ) ? tiles->source->base : 0;
+
+	uint8_t level = tiles->source->base;
+
+	while ( level + 1 < tiles->source->levels && zoom * ( 1 << ( level + 1 ) ) <= 1.0 ) level++;
+
+	return level;
+}
+
+void image_tiles_get_level_size ( ImageTiles *tiles, uint8_t level, int *width, int *height )
+{
+	*width  = ( tiles->source ) ? tiles->source->level_w[level] : 0;
+	*height = ( tiles->source ) ? tiles->source->level_h[level] : 0;
+}
+
+cairo_surface_t * image_tiles_get_overview ( ImageTiles *tiles )
+{
+	return tiles->overview;
+}
+
+/* Borrowed surface, or NULL while the tile is being read in */
+cairo_surface_t * image_tiles_get ( ImageTiles *tiles, uint8_t level, uint tx, uint ty )
+{
+	if ( !tiles->source || !tiles->built || level < tiles->source->base || level >= tiles->source->levels ) return NULL;
+
+	uint64_t key = image_tiles_key ( level, tx, ty );
+
+	TileEntry *entry = g_hash_table_lookup ( tiles->cache, &key );
+
+	if ( entry )
+	{
+		g_queue_unlink ( &tiles->lru, &entry->link );
+		g_queue_push_head_link ( &tiles->lru, &entry->link );
+
+		return entry->surface;
+	}
+
+	if ( g_hash_table_contains ( tiles->pending, &key ) ) return NULL;
+
+	uint64_t *pkey = g_new ( uint64_t, 1 );
+	*pkey = key;
+
+	g_hash_table_add ( tiles->pending, pkey );
+
+	image_tiles_push ( tiles, FALSE, key );
+
+	return NULL;
+}
+
+void image_tiles_free ( ImageTiles *tiles )
+{
+	image_tiles_close ( tiles );
+
+	g_thread_pool_free ( tiles->pool, FALSE, TRUE );
+
+	g_mutex_lock ( &tiles->lock );
+
+	if ( tiles->src_done ) g_source_remove ( tiles->src_done );
+
+	g_slist_free_full ( tiles->done, (GDestroyNotify)image_tiles_done_free );
+
+	g_mutex_unlock ( &tiles->lock );
+
+	g_hash_table_unref ( tiles->cache );
+	g_hash_table_unref ( tiles->pending );
+
+	g_mutex_clear ( &tiles->lock );
+
+	free ( tiles );
+}
+
+ImageTiles * image_tiles_new ( uint64_t max_bytes, TilesFunc func, gpointer data )
+{
+	ImageTiles *tiles = g_new0 ( ImageTiles, 1 );
+
+	g_mutex_init ( &tiles->lock );
+
+	tiles->max_bytes = max_bytes;
+	tiles->func = func;
+	tiles->data = data;
+
+	tiles->cache   = g_hash_table_new_full ( g_int64_hash, g_int64_equal, NULL, (GDestroyNotify)image_tiles_entry_free );
+	tiles->pending = g_hash_table_new_full ( g_int64_hash, g_int64_equal, free, NULL );
+
+	g_queue_init ( &tiles->lru );
+
+	int threads = CLAMP ( (int)g_get_num_processors () / 2, 2, 4 );
+
+	tiles->pool = g_thread_pool_new ( (GFunc)image_tiles_thread, tiles, threads, FALSE, NULL );
+
+	return tiles;
+}
@@ -0,0 +1,37 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+#define TILE_SIZE 256
+#define TILE_LEVELS 16
+
+typedef struct _ImageTiles ImageTiles;
+
+typedef void ( *TilesFunc ) ( gpointer );
+
+ImageTiles * image_tiles_new ( uint64_t, TilesFunc, gpointer );
+
+void image_tiles_free ( ImageTiles * );
+
+void image_tiles_open ( ImageTiles *, const char *, int, int );
+
+void image_tiles_close ( ImageTiles * );
+
+gboolean image_tiles_is_open ( ImageTiles *, const char *, int, int );
+
+uint8_t image_tiles_get_level ( ImageTiles *, double );
+
+void image_tiles_get_level_size ( ImageTiles *, uint8_t, int *, int * );
+
+cairo_surface_t * image_tiles_get_overview ( ImageTiles * );
+
+cairo_surface_t * image_tiles_get ( ImageTiles *, uint8_t, uint, uint );
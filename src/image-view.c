@@ -0,0 +1,725 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-view.h"
+#include "image-tiles.h"
+#include "image-svg.h"
+#include "image-ops.h"
+
+#define VIEW_TILES_BYTES ( 96 * 1024 * 1024 )
+#define VIEW_SVG_BYTES ( 64 * 1024 * 1024 )
+#define VIEW_REFINE_MS 150
+
+enum prop_enm
+{
+	PROP_0,
+	PROP_HADJUSTMENT,
+	PROP_VADJUSTMENT,
+	PROP_HSCROLL_POLICY,
+	PROP_VSCROLL_POLICY
+};
+
+typedef struct _ViewRefine ViewRefine;
+
+struct _ViewRefine
+{
+	GdkPixbuf *pixbuf;
+	cairo_surface_t *scaled;
+
+	int width;
+	int height;
+
+	double zoom;
+	uint serial;
+};
+
+/* Scrollable drawing area: the widget is never larger than the window.
+   Either a decode kept as one premultiplied surface, or tiles of a very large image;
+   both are scaled and oriented by cairo at draw time, so pan, zoom and resize are redraws.
+   Vector images are tiles rendered at the zoom itself. */
+struct _ImageView
+{
+	GtkDrawingArea parent_instance;
+
+	GtkAdjustment *hadj;
+	GtkAdjustment *vadj;
+
+	GtkScrollablePolicy hpolicy;
+	GtkScrollablePolicy vpolicy;
+
+	ImageTiles *tiles;
+
+	ImageSvg *svg;
+	double svg_zoom;
+
+	GdkPixbuf *pixbuf;
+	cairo_surface_t *surface;
+
+	cairo_surface_t *scaled;
+	double scaled_zoom;
+
+	int width;
+	int height;
+
+	uint8_t orient;
+
+	double zoom;
+	uint src_refine;
+
+	GMutex lock;
+	GThreadPool *pool;
+
+	ViewRefine *refine;
+	uint src_post;
+	uint serial;
+};
+
+G_DEFINE_TYPE_WITH_CODE ( ImageView, image_view, GTK_TYPE_DRAWING_AREA, G_IMPLEMENT_INTERFACE ( GTK_TYPE_SCROLLABLE, NULL ) )
+
+static inline double image_view_floor ( double v )
+{
+	int64_t i = (int64_t)v;
+
+	return (double)( i - ( v < i ) );
+}
+
+/* Size of the oriented image at the current zoom */
+static void image_view_content ( ImageView *view, double *cw, double *ch )
+{
+	gboolean swap = ( view->orient >= 5 );
+
+	*cw = ( ( swap ) ? view->height : view->width  ) * view->zoom;
+	*ch = ( ( swap ) ? view->width  : view->height ) * view->zoom;
+}
+
+static void image_view_origin ( ImageView *view, double *x, double *y )
+{
+	int aw = gtk_widget_get_allocated_width  ( GTK_WIDGET ( view ) );
+	int ah = gtk_widget_get_allocated_height ( GTK_WIDGET ( view ) );
+
+	double cw = 0, ch = 0;
+	image_view_content ( view, &cw, &ch );
+
+	*x = image_view_floor ( ( cw < aw ) ? ( aw - cw ) / 2 : -gtk_adjustment_get_value ( view->hadj ) );
+	*y = image_view_floor ( ( ch < ah ) ? ( ah - ch ) / 2 : -gtk_adjustment_get_value ( view->vadj ) );
+}
+
+static void image_view_configure_adj ( GtkAdjustment *adj, double content, int page )
+{
+	if ( !adj ) return;
+
+	double upper = MAX ( content, page );
+
+	gtk_adjustment_configure ( adj, CLAMP ( gtk_adjustment_get_value ( adj ), 0, upper - page ), 0, upper, page * 0.1, page * 0.9, page );
+}
+
+static void image_view_configure ( ImageView *view )
+{
+	double cw = 0, ch = 0;
+	image_view_content ( view, &cw, &ch );
+
+	image_view_configure_adj ( view->hadj, cw, gtk_widget_get_allocated_width  ( GTK_WIDGET ( view ) ) );
+	image_view_configure_adj ( view->vadj, ch, gtk_widget_get_allocated_height ( GTK_WIDGET ( view ) ) );
+}
+
+/* Image space to the widget: origin, zoom, then the orientation of the unrotated image */
+static void image_view_transform ( ImageView *view, cairo_t *cr )
+{
+	double ox = 0, oy = 0;
+	image_view_origin ( view, &ox, &oy );
+
+	cairo_translate ( cr, ox, oy );
+	cairo_scale ( cr, view->zoom, view->zoom );
+
+	cairo_matrix_t matrix;
+	image_ops_orient_matrix ( view->orient, view->width, view->height, &matrix );
+
+	cairo_transform ( cr, &matrix );
+}
+
+/* The first w x h pixels of a surface at ( x, y ) in image space, scaled by sx, sy;
+   the clip is snapped to device pixels, so tiles meet without seams */
+static void image_view_draw_surface ( cairo_t *cr, cairo_surface_t *surface, double x, double y, double sx, double sy, int w, int h, cairo_filter_t filter )
+{
+	double x1 = x, y1 = y, x2 = x + w * sx, y2 = y + h * sy;
+
+	cairo_user_to_device ( cr, &x1, &y1 );
+	cairo_user_to_device ( cr, &x2, &y2 );
+
+	double cx1 = image_view_floor ( MIN ( x1, x2 ) + 0.5 ), cy1 = image_view_floor ( MIN ( y1, y2 ) + 0.5 );
+	double cx2 = image_view_floor ( MAX ( x1, x2 ) + 0.5 ), cy2 = image_view_floor ( MAX ( y1, y2 ) + 0.5 );
+
+	cairo_save ( cr );
+
+	cairo_matrix_t matrix;
+	cairo_get_matrix ( cr, &matrix );
+
+	cairo_identity_matrix ( cr );
+	cairo_rectangle ( cr, cx1, cy1, cx2 - cx1, cy2 - cy1 );
+	cairo_clip ( cr );
+
+	cairo_set_matrix ( cr, &matrix );
+
+	cairo_translate ( cr, x, y );
+	cairo_scale ( cr, sx, sy );
+
+	cairo_set_source_surface ( cr, surface, 0, 0 );
+
+	cairo_pattern_set_extend ( cairo_get_source ( cr ), CAIRO_EXTEND_PAD );
+	cairo_pattern_set_filter ( cairo_get_source ( cr ), filter );
+
+	cairo_paint ( cr );
+
+	cairo_restore ( cr );
+}
+
+/* Nearest while zooming, bilinear once settled; an exact 1:1 is always nearest */
+static cairo_filter_t image_view_filter ( ImageView *view, double scale )
+{
+	return ( view->src_refine || ABS ( scale - 1.0 ) < 1e-6 ) ? CAIRO_FILTER_FAST : CAIRO_FILTER_GOOD;
+}
+
+/* Whole surface over the image */
+static void image_view_draw_fit ( ImageView *view, cairo_t *cr, cairo_surface_t *surface, cairo_filter_t filter )
+{
+	int w = cairo_image_surface_get_width  ( surface );
+	int h = cairo_image_surface_get_height ( surface );
+
+	image_view_draw_surface ( cr, surface, 0, 0, (double)view->width / w, (double)view->height / h, w, h, filter );
+}
+
+static void image_view_draw_image ( ImageView *view, cairo_t *cr )
+{
+	if ( view->scaled && view->scaled_zoom == view->zoom ) { image_view_draw_fit ( view, cr, view->scaled, CAIRO_FILTER_FAST ); return; }
+
+	double scale = view->zoom * view->width / cairo_image_surface_get_width ( view->surface );
+
+	image_view_draw_fit ( view, cr, view->surface, image_view_filter ( view, scale ) );
+}
+
+static void image_view_draw_tiles ( ImageView *view, cairo_t *cr )
+{
+	cairo_surface_t *overview = image_tiles_get_overview ( view->tiles );
+
+	if ( overview ) image_view_draw_fit ( view, cr, overview, CAIRO_FILTER_GOOD );
+
+	double x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+	cairo_clip_extents ( cr, &x1, &y1, &x2, &y2 );
+
+	uint8_t level = image_tiles_get_level ( view->tiles, view->zoom );
+
+	int lw = 0, lh = 0;
+	image_tiles_get_level_size ( view->tiles, level, &lw, &lh );
+
+	double sx = (double)view->width / lw, sy = (double)view->height / lh;
+
+	int ntx = ( lw + TILE_SIZE - 1 ) / TILE_SIZE;
+	int nty = ( lh + TILE_SIZE - 1 ) / TILE_SIZE;
+
+	int tx1 = CLAMP ( (int)image_view_floor ( x1 / ( sx * TILE_SIZE ) ), 0, ntx - 1 );
+	int tx2 = CLAMP ( (int)image_view_floor ( x2 / ( sx * TILE_SIZE ) ), 0, ntx - 1 );
+	int ty1 = CLAMP ( (int)image_view_floor ( y1 / ( sy * TILE_SIZE ) ), 0, nty - 1 );
+	int ty2 = CLAMP ( (int)image_view_floor ( y2 / ( sy * TILE_SIZE ) ), 0, nty - 1 );
+
+	cairo_filter_t filter = image_view_filter ( view, view->zoom * sx );
+
+	int ty = 0; for ( ty = ty1; ty <= ty2; ty++ )
+	{
+		int tx = 0; for ( tx = tx1; tx <= tx2; tx++ )
+		{
+			cairo_surface_t *surface = image_tiles_get ( view->tiles, level, (uint)tx, (uint)ty );
+
+			if ( !surface ) continue;
+
+			int tw = MIN ( TILE_SIZE, lw - tx * TILE_SIZE );
+			int th = MIN ( TILE_SIZE, lh - ty * TILE_SIZE );
+
+			image_view_draw_surface ( cr, surface, tx * TILE_SIZE * sx, ty * TILE_SIZE * sy, sx, sy, tw, th, filter );
+		}
+	}
+}
+
+/* Tiles of one zoom over the clip; TRUE when all of them were there */
+static gboolean image_view_draw_svg_zoom ( ImageView *view, cairo_t *cr, double zoom, gboolean request )
+{
+	double x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+	cairo_clip_extents ( cr, &x1, &y1, &x2, &y2 );
+
+	double lw = view->width * zoom, lh = view->height * zoom;
+
+	int ntx = (int)( ( lw + SVG_TILE - 1 ) / SVG_TILE );
+	int nty = (int)( ( lh + SVG_TILE - 1 ) / SVG_TILE );
+
+	int tx1 = CLAMP ( (int)image_view_floor ( x1 * zoom / SVG_TILE ), 0, ntx - 1 );
+	int tx2 = CLAMP ( (int)image_view_floor ( x2 * zoom / SVG_TILE ), 0, ntx - 1 );
+	int ty1 = CLAMP ( (int)image_view_floor ( y1 * zoom / SVG_TILE ), 0, nty - 1 );
+	int ty2 = CLAMP ( (int)image_view_floor ( y2 * zoom / SVG_TILE ), 0, nty - 1 );
+
+	cairo_filter_t filter = ( zoom == view->zoom ) ? CAIRO_FILTER_FAST : CAIRO_FILTER_GOOD;
+
+	gboolean all = TRUE;
+
+	int ty = 0; for ( ty = ty1; ty <= ty2; ty++ )
+	{
+		int tx = 0; for ( tx = tx1; tx <= tx2; tx++ )
+		{
+			cairo_surface_t *surface = image_svg_get ( view->svg, zoom, (uint)tx, (uint)ty, request );
+
+			if ( !surface ) { all = FALSE; continue; }
+
+			int tw = MIN ( SVG_TILE, (int)( lw + 0.5 ) - tx * SVG_TILE );
+			int th = MIN ( SVG_TILE, (int)( lh + 0.5 ) - ty * SVG_TILE );
+
+			image_view_draw_surface ( cr, surface, tx * SVG_TILE / zoom, ty * SVG_TILE / zoom, 1 / zoom, 1 / zoom, MAX ( tw, 1 ), MAX ( th, 1 ), filter );
+		}
+	}
+
+	return all;
+}
+
+/* While zooming, the last complete zoom is scaled; tiles at the new zoom are asked for once it stops */
+static void image_view_draw_svg ( ImageView *view, cairo_t *cr )
+{
+	cairo_surface_t *overview = image_svg_get_overview ( view->svg );
+
+	if ( overview ) image_view_draw_fit ( view, cr, overview, CAIRO_FILTER_GOOD );
+
+	if ( view->svg_zoom > 0 && view->svg_zoom != view->zoom ) image_view_draw_svg_zoom ( view, cr, view->svg_zoom, FALSE );
+
+	if ( image_view_draw_svg_zoom ( view, cr, view->zoom, !view->src_refine ) ) view->svg_zoom = view->zoom;
+}
+
+static gboolean image_view_draw ( GtkWidget *widget, cairo_t *cr )
+{
+	ImageView *view = IMAGE_VIEW ( widget );
+
+	gboolean vector = image_svg_is_open ( view->svg );
+
+	if ( !view->surface && !vector && !image_tiles_is_open ( view->tiles, NULL, 0, 0 ) ) return GDK_EVENT_PROPAGATE;
+
+	cairo_save ( cr );
+
+	image_view_transform ( view, cr );
+
+	if ( view->surface ) image_view_draw_image ( view, cr );
+	else if ( vector ) image_view_draw_svg ( view, cr );
+	else image_view_draw_tiles ( view, cr );
+
+	cairo_restore ( cr );
+
+	return GDK_EVENT_PROPAGATE;
+}
+
+static void image_view_size_allocate ( GtkWidget *widget, GtkAllocation *allocation )
+{
+	GTK_WIDGET_CLASS ( image_view_parent_class )->size_allocate ( widget, allocation );
+
+	image_view_configure ( IMAGE_VIEW ( widget ) );
+}
+
+static void image_view_adj_changed ( G_GNUC_UNUSED GtkAdjustment *adj, ImageView *view )
+{
+	gtk_widget_queue_draw ( GTK_WIDGET ( view ) );
+}
+
+static void image_view_set_adj ( ImageView *view, GtkAdjustment **adj_view, GtkAdjustment *adj )
+{
+	if ( *adj_view == adj && adj ) return;
+
+	if ( *adj_view )
+	{
+		g_signal_handlers_disconnect_by_func ( *adj_view, image_view_adj_changed, view );
+
+		g_object_unref ( *adj_view );
+	}
+
+	if ( !adj ) adj = gtk_adjustment_new ( 0, 0, 0, 0, 0, 0 );
+
+	*adj_view = g_object_ref_sink ( adj );
+
+	g_signal_connect ( adj, "value-changed", G_CALLBACK ( image_view_adj_changed ), view );
+
+	image_view_configure ( view );
+}
+
+static void image_view_set_property ( GObject *object, uint prop_id, const GValue *value, GParamSpec *pspec )
+{
+	ImageView *view = IMAGE_VIEW ( object );
+
+	switch ( prop_id )
+	{
+		case PROP_HADJUSTMENT: image_view_set_adj ( view, &view->hadj, g_value_get_object ( value ) ); break;
+		case PROP_VADJUSTMENT: image_view_set_adj ( view, &view->vadj, g_value_get_object ( value ) ); break;
+
+		case PROP_HSCROLL_POLICY: view->hpolicy = g_value_get_enum ( value ); break;
+		case PROP_VSCROLL_POLICY: view->vpolicy = g_value_get_enum ( value ); break;
+
+		default: G_OBJECT_WARN_INVALID_PROPERTY_ID ( object, prop_id, pspec ); break;
+	}
+}
+
+static void image_view_get_property ( GObject *object, uint prop_id, GValue *value, GParamSpec *pspec )
+{
+	ImageView *view = IMAGE_VIEW ( object );
+
+	switch ( prop_id )
+	{
+		case PROP_HADJUSTMENT: g_value_set_object ( value, view->hadj ); break;
+		case PROP_VADJUSTMENT: g_value_set_object ( value, view->vadj ); break;
+
+		case PROP_HSCROLL_POLICY: g_value_set_enum ( value, view->hpolicy ); break;
+		case PROP_VSCROLL_POLICY: g_value_set_enum ( value, view->vpolicy ); break;
+
+		default: G_OBJECT_WARN_INVALID_PROPERTY_ID ( object, prop_id, pspec ); break;
+	}
+}
+
+double image_view_get_zoom ( ImageView *view )
+{
+	return view->zoom;
+}
+
+static void image_view_refine_free ( ViewRefine *refine )
+{
+	if ( refine->scaled ) cairo_surface_destroy ( refine->scaled );
+
+	g_object_unref ( refine->pixbuf );
+
+	free ( refine );
+}
+
+/* Main thread: refines of an older zoom or image are dropped by serial */
+static void image_view_refine_cancel ( ImageView *view )
+{
+	g_mutex_lock ( &view->lock );
+
+	view->serial++;
+
+	g_mutex_unlock ( &view->lock );
+}
+
+static gboolean image_view_refine_done ( ImageView *view )
+{
+	g_mutex_lock ( &view->lock );
+
+	ViewRefine *refine = view->refine;
+
+	view->refine = NULL;
+	view->src_post = 0;
+
+	g_mutex_unlock ( &view->lock );
+
+	if ( refine && refine->serial == view->serial )
+	{
+		if ( view->scaled ) cairo_surface_destroy ( view->scaled );
+
+		view->scaled = refine->scaled;
+		view->scaled_zoom = refine->zoom;
+
+		refine->scaled = NULL;
+
+		gtk_widget_queue_draw ( GTK_WIDGET ( view ) );
+	}
+
+	if ( refine ) image_view_refine_free ( refine );
+
+	return G_SOURCE_REMOVE;
+}
+
+static void image_view_refine_thread ( ViewRefine *refine, ImageView *view )
+{
+	g_mutex_lock ( &view->lock );
+
+	gboolean stale = ( refine->serial != view->serial );
+
+	g_mutex_unlock ( &view->lock );
+
+	if ( stale ) { image_view_refine_free ( refine ); return; }
+
+	int64_t t = g_get_monotonic_time ();
+
+	GdkPixbuf *pixbuf = image_ops_scale ( refine->pixbuf, refine->width, refine->height, OPS_LANCZOS );
+
+	refine->scaled = ( pixbuf ) ? image_ops_surface ( pixbuf ) : NULL;
+
+	if ( pixbuf ) g_object_unref ( pixbuf );
+
+	g_debug ( "%s:: %d x %d, %.2f ms", __func__, refine->width, refine->height, (double)( g_get_monotonic_time () - t ) / 1000 );
+
+	g_mutex_lock ( &view->lock );
+
+	if ( refine->scaled && refine->serial == view->serial )
+	{
+		if ( view->refine ) image_view_refine_free ( view->refine );
+
+		view->refine = refine;
+
+		if ( !view->src_post ) view->src_post = g_idle_add ( (GSourceFunc)image_view_refine_done, view );
+
+		refine = NULL;
+	}
+
+	g_mutex_unlock ( &view->lock );
+
+	if ( refine ) image_view_refine_free ( refine );
+}
+
+/* Zooming has stopped: a downscale is redone once with Lanczos on the worker, an upscale stays with cairo's bilinear.
+   Until it arrives, and when the zoom changes again meanwhile, cairo scales the decode. */
+static gboolean image_view_refine ( ImageView *view )
+{
+	view->src_refine = 0;
+
+	int w = MAX ( 1, (int)( view->width  * view->zoom + 0.5 ) );
+	int h = MAX ( 1, (int)( view->height * view->zoom + 0.5 ) );
+
+	if ( view->scaled && view->scaled_zoom == view->zoom ) return G_SOURCE_REMOVE;
+
+	if ( view->scaled ) cairo_surface_destroy ( view->scaled );
+
+	view->scaled = NULL;
+
+	if ( view->pixbuf && w < gdk_pixbuf_get_width ( view->pixbuf ) )
+	{
+		ViewRefine *refine = g_new0 ( ViewRefine, 1 );
+
+		refine->pixbuf = g_object_ref ( view->pixbuf );
+		refine->width  = w;
+		refine->height = h;
+		refine->zoom   = view->zoom;
+		refine->serial = view->serial;
+
+		g_thread_pool_push ( view->pool, refine, NULL );
+	}
+
+	gtk_widget_queue_draw ( GTK_WIDGET ( view ) );
+
+	return G_SOURCE_REMOVE;
+}
+
+static void image_view_clear_image ( ImageView *view )
+{
+	if ( view->src_refine ) g_source_remove ( view->src_refine );
+
+	image_view_refine_cancel ( view );
+
+	if ( view->pixbuf  ) g_object_unref ( view->pixbuf );
+	if ( view->surface ) cairo_surface_destroy ( view->surface );
+	if ( view->scaled  ) cairo_surface_destroy ( view->scaled );
+
+	view->pixbuf  = NULL;
+	view->surface = NULL;
+	view->scaled  = NULL;
+
+	view->src_refine = 0;
+}
+
+/* The image point under ( x, y ) stays under it */
+void image_view_set_zoom ( ImageView *view, double zoom, double x, double y )
+{
+	double ox = 0, oy = 0;
+	image_view_origin ( view, &ox, &oy );
+
+	double px = ( x - ox ) / view->zoom;
+	double py = ( y - oy ) / view->zoom;
+
+	view->zoom = zoom;
+
+	image_view_configure ( view );
+
+	gtk_adjustment_set_value ( view->hadj, px * zoom - x );
+	gtk_adjustment_set_value ( view->vadj, py * zoom - y );
+
+	if ( view->src_refine ) g_source_remove ( view->src_refine );
+
+	image_view_refine_cancel ( view );
+
+	view->src_refine = g_timeout_add ( VIEW_REFINE_MS, (GSourceFunc)image_view_refine, view );
+
+	gtk_widget_queue_draw ( GTK_WIDGET ( view ) );
+}
+
+void image_view_set_orient ( ImageView *view, uint8_t orient )
+{
+	if ( view->orient == orient ) return;
+
+	view->orient = orient;
+
+	image_view_configure ( view );
+
+	gtk_widget_queue_draw ( GTK_WIDGET ( view ) );
+}
+
+/* The decode of a width x height image, converted once; it is shown 1:1 unless keep,
+   which holds zoom and position when a sharper decode of the same image replaces it */
+void image_view_set_pixbuf ( ImageView *view, GdkPixbuf *pixbuf, int width, int height, gboolean keep )
+{
+	int64_t t = g_get_monotonic_time ();
+
+	image_tiles_close ( view->tiles );
+	image_svg_close ( view->svg );
+
+	image_view_clear_image ( view );
+
+	view->surface = image_ops_surface ( pixbuf );
+	view->pixbuf  = ( view->surface ) ? g_object_ref ( pixbuf ) : NULL;
+
+	keep = ( keep && view->width == width && view->height == height );
+
+	view->width  = width;
+	view->height = height;
+
+	if ( !keep ) view->zoom = (double)gdk_pixbuf_get_width ( pixbuf ) / width;
+
+	image_view_configure ( view );
+
+	if ( !keep ) gtk_adjustment_set_value ( view->hadj, 0 );
+	if ( !keep ) gtk_adjustment_set_value ( view->vadj, 0 );
+
+	gtk_widget_queue_draw ( GTK_WIDGET ( view ) );
+
+	g_debug ( "%s:: %d x %d, %.2f ms", __func__, gdk_pixbuf_get_width ( pixbuf ), gdk_pixbuf_get_height ( pixbuf ), (double)( g_get_monotonic_time () - t ) / 1000 );
+}
+
+/* Animation frames: same size as the pixbuf they follow, already converted, nothing to refine */
+void image_view_set_frame ( ImageView *view, cairo_surface_t *surface )
+{
+	if ( !view->surface ) return;
+
+	image_view_clear_image ( view );
+
+	view->surface = cairo_surface_reference ( surface );
+
+	gtk_widget_queue_draw ( GTK_WIDGET ( view ) );
+}
+
+void image_view_open ( ImageView *view, const char *path, int width, int height )
+{
+	if ( image_tiles_is_open ( view->tiles, path, width, height ) ) return;
+
+	image_view_clear_image ( view );
+	image_svg_close ( view->svg );
+
+	image_tiles_open ( view->tiles, path, width, height );
+
+	view->width  = width;
+	view->height = height;
+	view->zoom   = 1.0;
+
+	image_view_configure ( view );
+
+	gtk_adjustment_set_value ( view->hadj, 0 );
+	gtk_adjustment_set_value ( view->vadj, 0 );
+
+	gtk_widget_queue_draw ( GTK_WIDGET ( view ) );
+}
+
+/* width x height is the size at zoom 1; FALSE when the document can not be rendered as vectors */
+gboolean image_view_open_svg ( ImageView *view, const char *path, int width, int height )
+{
+	if ( !image_svg_open ( view->svg, path, width, height ) ) return FALSE;
+
+	image_view_clear_image ( view );
+	image_tiles_close ( view->tiles );
+
+	view->width  = width;
+	view->height = height;
+	view->zoom   = 1.0;
+	view->svg_zoom = 0;
+
+	image_view_configure ( view );
+
+	gtk_adjustment_set_value ( view->hadj, 0 );
+	gtk_adjustment_set_value ( view->vadj, 0 );
+
+	gtk_widget_queue_draw ( GTK_WIDGET ( view ) );
+
+	return TRUE;
+}
+
+void image_view_close ( ImageView *view )
+{
+	image_tiles_close ( view->tiles );
+	image_svg_close ( view->svg );
+
+	image_view_clear_image ( view );
+
+	view->width  = 0;
+	view->height = 0;
+	view->zoom   = 1.0;
+
+	image_view_configure ( view );
+}
+
+static void image_view_init ( ImageView *view )
+{
+	view->zoom = 1.0;
+	view->orient = 1;
+
+	view->tiles = image_tiles_new ( VIEW_TILES_BYTES, (TilesFunc)gtk_widget_queue_draw, view );
+	view->svg = image_svg_new ( VIEW_SVG_BYTES, (SvgFunc)gtk_widget_queue_draw, view );
+
+	g_mutex_init ( &view->lock );
+
+	view->pool = g_thread_pool_new ( (GFunc)image_view_refine_thread, view, 1, FALSE, NULL );
+
+	image_view_set_adj ( view, &view->hadj, NULL );
+	image_view_set_adj ( view, &view->vadj, NULL );
+
+	gtk_widget_add_events ( GTK_WIDGET ( view ), GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK | GDK_POINTER_MOTION_MASK | GDK_SCROLL_MASK );
+}
+
+static void image_view_finalize ( GObject *object )
+{
+	ImageView *view = IMAGE_VIEW ( object );
+
+	image_tiles_free ( view->tiles );
+	image_svg_free ( view->svg );
+
+	image_view_clear_image ( view );
+
+	g_thread_pool_free ( view->pool, FALSE, TRUE );
+
+	if ( view->src_post ) g_source_remove ( view->src_post );
+
+	if ( view->refine ) image_view_refine_free ( view->refine );
+
+	g_mutex_clear ( &view->lock );
+
+	if ( view->hadj ) g_signal_handlers_disconnect_by_func ( view->hadj, image_view_adj_changed, view );
+	if ( view->vadj ) g_signal_handlers_disconnect_by_func ( view->vadj, image_view_adj_changed, view );
+
+	if ( view->hadj ) g_object_unref ( view->hadj );
+	if ( view->vadj ) g_object_unref ( view->vadj );
+
+	G_OBJECT_CLASS ( image_view_parent_class )->finalize ( object );
+}
+
+static void image_view_class_init ( ImageViewClass *class )
+{
+	GObjectClass *oclass = G_OBJECT_CLASS (class);
+	GtkWidgetClass *wclass = GTK_WIDGET_CLASS (class);
+
+	oclass->finalize = image_view_finalize;
+	oclass->set_property = image_view_set_property;
+	oclass->get_property = image_view_get_property;
+
+	wclass->draw = image_view_draw;
+	wclass->size_allocate = image_view_size_allocate;
+
+	g_object_class_override_property ( oclass, PROP_HADJUSTMENT,    "hadjustment"    );
+	g_object_class_override_property ( oclass, PROP_VADJUSTMENT,    "vadjustment"    );
+	g_object_class_override_property ( oclass, PROP_HSCROLL_POLICY, "hscroll-policy" );
+	g_object_class_override_property ( oclass, PROP_VSCROLL_POLICY, "vscroll-policy" );
+}
+
+ImageView * image_view_new ( void )
+{
+	return g_object_new ( IMAGE_TYPE_VIEW, NULL );
+}
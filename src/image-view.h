@@ -0,0 +1,34 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+#define IMAGE_TYPE_VIEW image_view_get_type ()
+
+G_DECLARE_FINAL_TYPE ( ImageView, image_view, IMAGE, VIEW, GtkDrawingArea )
+
+ImageView * image_view_new ( void );
+
+void image_view_open ( ImageView *, const char *, int, int );
+
+gboolean image_view_open_svg ( ImageView *, const char *, int, int );
+
+void image_view_set_pixbuf ( ImageView *, GdkPixbuf *, int, int, gboolean );
+
+void image_view_set_frame ( ImageView *, cairo_surface_t * );
+
+void image_view_set_orient ( ImageView *, uint8_t );
+
+void image_view_close ( ImageView * );
+
+double image_view_get_zoom ( ImageView * );
+
+void image_view_set_zoom ( ImageView *, double, double, double );
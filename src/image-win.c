@@ -8,14 +8,26 @@
 */
 
 #include "image-win.h"
-
-#include <errno.h>
+#include "image-index.h"
+#include "image-prefetch.h"
+#include "image-stream.h"
+#include "image-anim.h"
+#include "image-slide.h"
+#include "image-thumb.h"
+#include "image-icon.h"
+#include "image-ops.h"
+#include "image-view.h"
 
 #define ITEM_WIDTH 80
+#define PREFETCH_DEPTH 2
+#define PREFETCH_BYTES ( 256 * 1024 * 1024 )
+#define THUMB_QUEUE 64
+#define THUMB_FRAME_US 4000
+#define TILES_PIXELS ( 4096 * 4096 )
+#define VECTOR_ZOOM_MAX 64.0
+#define FIT_DECODE_MS 250
 #define UNUSED G_GNUC_UNUSED
 
-G_LOCK_DEFINE_STATIC ( done_th );
-
 enum cols_enm
 {
 	COL_PATH,
@@ -24,9 +36,21 @@ enum cols_enm
 	COL_IS_LINK,
 	COL_IS_PIXBUF,
 	COL_PIXBUF,
+	COL_KEY,
+	COL_CONTENT_TYPE,
+	COL_ICON,
+	COL_MTIME,
+	COL_SIZE,
 	NUM_COLS
 };
 
+enum thumb_enm
+{
+	THUMB_NONE,
+	THUMB_QUEUED,
+	THUMB_DONE
+};
+
 enum size_enm
 {
 	SIZEx24,
@@ -58,13 +82,13 @@ const SizeDescr icon_descr_size_n[] =
 	{ SIZEx256, 256 }
 };
 
-enum pb_enm
+/* EXIF orientation codes, see image-ops.h */
+enum orient_enm
 {
-	POR,
-	PHR,
-	PVT,
-	PLT,
-	PRT
+	ORIENT_HR = 2,
+	ORIENT_VT = 4,
+	ORIENT_RT = 6,
+	ORIENT_LT = 8
 };
 
 enum bt_enm
@@ -119,43 +143,79 @@ struct _ImageWin
 
 	GFile *file;
 
-	GtkImage *image;
+	GdkPixbuf *source;
+	ImageLoad load;
+
+	ImageView *view;
 	GtkScrolledWindow *swin_img;
 
 	GtkButton *button_play;
 	GtkPopover *popover_time;
 
-	enum pb_enm pb_type_lr;
-	enum pb_enm pb_type_hv;
+	uint8_t orient;
 
 	double av_val;
 	double ah_val;
 
-	uint src_play;
-	uint16_t timeout;
+	uint src_fit;
+	uint32_t timeout;
 
-	gboolean config;
 	gboolean original;
+	gboolean tiled;
+	gboolean vector;
+
+	ImageIndex *index;
+	ImagePrefetch *prefetch;
+	ImageCache *cache;
+	ImageSlide *slide;
+
+	ImageStream *stream;
+	int64_t t_stream;
+	int stream_w;
+	int stream_h;
+	gboolean stream_shown;
+	gboolean streaming;
+
+	GFile *stream_prev;
+	gboolean stream_back;
+	gboolean stream_prw;
+
+	ImageStream *sharp;
+	int sharp_w;
+	int sharp_h;
+	gboolean sharp_fit;
+
+	ImageAnim *anim;
+	gboolean animated;
 
 	GtkIconView *icon_view;
 	GtkScrolledWindow *swin_prw;
 
 	GFile *dir;
-	GtkTreeModel *model_t;
+	GStringChunk *keys;
+	GCancellable *enum_cancel;
+
+	ImageThumbPool *thumb_pool;
+	ImageThumbClient *thumb_client;
+	GCancellable *thumb_cancel;
 
-	uint8_t   mod_t;
-	uint8_t limit_t;
-	uint64_t  end_t;
+	uint8_t *thumb_state;
+	ThumbJob *thumb_pending;
+
+	uint thumb_rows;
+	uint thumb_done;
+	uint thumb_serial;
+	uint thumb_left;
+
+	uint thumb_fwd;
+	uint thumb_back;
+
+	uint tick_thumb;
+	uint src_rank;
 
 	uint16_t icon_size;
 
 	gboolean preview;
-
-	gboolean break_t;
-	gboolean done_t_0;
-	gboolean done_t_1;
-	gboolean done_t_2;
-	gboolean done_t_3;
 };
 
 G_DEFINE_TYPE ( ImageWin, image_win, GTK_TYPE_WINDOW )
@@ -163,6 +223,7 @@ G_DEFINE_TYPE ( ImageWin, image_win, GTK_TYPE_WINDOW )
 typedef void ( *fp ) ( ImageWin * );
 
 static void image_win_run_autoplay ( ImageWin * );
+static void image_win_prefetch ( uint, gboolean, ImageWin * );
 static void win_set_dir_file ( GFile *, ImageWin * );
 
 static void dialog_message ( const char *f_error, const char *file_or_info, GtkMessageType mesg_type, GtkWindow *window )
@@ -199,36 +260,17 @@ static void win_about ( GtkWindow *window )
 	gtk_widget_destroy ( GTK_WIDGET (dialog) );
 }
 
-static gboolean image_win_check_pixbuf ( const char *path )
-{
-	gboolean ret = TRUE;
-
-	GError *error = NULL;
-	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file ( path, &error );
-
-	if ( error )
-	{
-		ret = FALSE;
-
-		g_warning ( "%s:: %s ", __func__, error->message );
-		g_error_free ( error );
-	}
-
-	if ( pixbuf ) g_object_unref ( pixbuf );
-
-	return ret;
-}
-
 static void image_win_changed_timeout ( GtkSpinButton *button, ImageWin *win )
 {
 	gtk_spin_button_update ( button );
 
-	win->timeout = (uint16_t)gtk_spin_button_get_value_as_int ( button );
+	win->timeout = (uint32_t)( gtk_spin_button_get_value ( button ) * 1000 + 0.5 );
 }
 
-static GtkSpinButton * image_win_create_spinbutton ( uint16_t val, uint16_t min, uint16_t max, uint16_t step, const char *text )
+static GtkSpinButton * image_win_create_spinbutton ( double val, double min, double max, double step, uint digits, const char *text )
 {
 	GtkSpinButton *spinbutton = (GtkSpinButton *)gtk_spin_button_new_with_range ( min, max, step );
+	gtk_spin_button_set_digits ( spinbutton, digits );
 	gtk_spin_button_set_value ( spinbutton, val );
 
 	gtk_entry_set_icon_from_icon_name ( GTK_ENTRY ( spinbutton ), GTK_ENTRY_ICON_PRIMARY, "appointment-new" );
@@ -254,7 +296,7 @@ static GtkPopover * image_win_pp_timeout ( ImageWin *win )
 	GtkBox *h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
 	gtk_box_set_spacing ( h_box, 5 );
 
-	GtkSpinButton *spinbutton = image_win_create_spinbutton ( win->timeout, 1, 3600, 1, "Seconds" );
+	GtkSpinButton *spinbutton = image_win_create_spinbutton ( win->timeout / 1000.0, 0.1, 3600, 0.1, 3, "Seconds" );
 	g_signal_connect ( spinbutton, "changed", G_CALLBACK ( image_win_changed_timeout ), win );
 
 	gtk_widget_set_visible ( GTK_WIDGET ( spinbutton ), TRUE );
@@ -272,196 +314,565 @@ static GtkPopover * image_win_pp_timeout ( ImageWin *win )
 	return popover;
 }
 
-static void image_win_set_label ( int org_w, int org_h, int scale_w, int scale_h, ImageWin *win )
+static void image_win_set_label ( int org_w, int org_h, int scale_w, int scale_h, uint64_t size, ImageWin *win )
 {
-	GFileInfo *finfo = g_file_query_info ( win->file, "standard::size", 0, NULL, NULL );
-
-	uint64_t size = g_file_info_get_attribute_uint64 ( finfo, G_FILE_ATTRIBUTE_STANDARD_SIZE );
-
 	g_autofree char *gsize = g_format_size ( size );
 
-	double prc = (double)( scale_w * scale_h ) * 100 / ( org_w * org_h );
+	double prc = (double)scale_w * scale_h * 100 / ( (double)org_w * org_h );
 
 	char text[256];
 	sprintf ( text, "%u%%  %d x %d  %s", (uint)prc, org_w, org_h, gsize );
 
 	gtk_label_set_text ( win->bar_label, text );
+}
 
-	if ( finfo ) g_object_unref ( finfo );
+/* User turns and flips on top of the EXIF orientation of the file */
+static uint8_t image_win_get_orient ( ImageWin *win )
+{
+	return image_ops_orient_compose ( win->load.orientation, win->orient );
 }
 
-static void image_win_set_image_plus_minus ( gboolean plus_minus, ImageWin *win )
+static void image_win_get_fit_size ( int *width, int *height, ImageWin *win )
 {
-	GdkPixbuf *pbimage = gtk_image_get_pixbuf ( win->image );
+	int w = gtk_widget_get_allocated_width  ( GTK_WIDGET ( win ) );
+	int h = gtk_widget_get_allocated_height ( GTK_WIDGET ( win ) );
 
-	if ( pbimage == NULL ) return;
+	gboolean vis = gtk_widget_get_visible ( GTK_WIDGET ( win->bar_box ) );
 
-	g_autofree char *path = g_file_get_path ( win->file );
+	if ( vis )
+	{
+		int bar_h = gtk_widget_get_allocated_height ( GTK_WIDGET ( win->bar_box ) );
 
-	GdkPixbuf *pbset = NULL;
+		h -= bar_h;
+	}
 
-	int width  = gdk_pixbuf_get_width  ( pbimage );
-	int height = gdk_pixbuf_get_height ( pbimage );
+	*width  = ( win->original ) ? 0 : w;
+	*height = ( win->original ) ? 0 : h;
+}
 
-	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file ( path, NULL );
+static void image_win_set_label_zoom ( ImageWin *win )
+{
+	double zoom = image_view_get_zoom ( win->view );
 
-	int pw = gdk_pixbuf_get_width  ( pixbuf );
-	int ph = gdk_pixbuf_get_height ( pixbuf );
+	image_win_set_label ( win->load.org_w, win->load.org_h, (int)( win->load.org_w * zoom + 0.5 ), (int)( win->load.org_h * zoom + 0.5 ), win->load.size, win );
+}
 
-	int set_w = ( plus_minus ) ? width  + ( pw / 10 ) : width  - ( pw / 10 );
-	int set_h = ( plus_minus ) ? height + ( ph / 10 ) : height - ( ph / 10 );
+/* The view keeps its own surface of the decode; source is the same pixbuf, kept for re-decode decisions */
+static void image_win_set_source ( GdkPixbuf *pixbuf, ImageLoad *load, gboolean keep, ImageWin *win )
+{
+	if ( win->source ) g_object_unref ( win->source );
 
-	if ( set_w > 16 && set_h > 16 ) pbset = gdk_pixbuf_new_from_file_at_size ( path, set_w, set_h, NULL );
+	win->source = ( pixbuf ) ? g_object_ref ( pixbuf ) : NULL;
+	win->load = *load;
+	win->tiled = FALSE;
+	win->vector = FALSE;
 
-	if ( pbset ) image_win_set_label ( pw, ph, set_w, set_h, win );
-	if ( pbset ) gtk_image_set_from_pixbuf ( win->image, pbset );
+	if ( pixbuf ) image_view_set_pixbuf ( win->view, pixbuf, load->org_w, load->org_h, keep );
+}
+
+/* Original size of a very large image: tiles from a background decode instead of one huge pixbuf */
+static gboolean image_win_set_tiled ( const char *path, ImageLoad *load, ImageWin *win )
+{
+	image_win_set_source ( NULL, load, FALSE, win );
+
+	image_view_open ( win->view, path, load->org_w, load->org_h );
 
-	if ( pbset  ) g_object_unref ( pbset  );
-	if ( pixbuf ) g_object_unref ( pixbuf );
+	image_view_set_orient ( win->view, image_win_get_orient ( win ) );
+
+	win->tiled = TRUE;
+
+	image_win_set_label_zoom ( win );
+
+	return TRUE;
 }
 
-static void image_win_set_image_vhlr ( enum pb_enm num, ImageWin *win )
+/* The cache of all windows first, then a prefetched decode, which goes to the cache as well;
+   load->mtime validates the cache */
+static GdkPixbuf * image_win_take ( const char *path, int w, int h, ImageLoad *load, GError **error, ImageWin *win )
 {
-	GdkPixbuf *pbimage = gtk_image_get_pixbuf ( win->image );
+	if ( !load->mtime && !image_load_mtime ( path, load, error ) ) return NULL;
 
-	if ( pbimage == NULL ) return;
+	GdkPixbuf *pixbuf = image_cache_lookup ( win->cache, path, w, h, load );
 
-	GdkPixbuf *pb = NULL;
+	if ( pixbuf ) return pixbuf;
+
+	pixbuf = image_prefetch_take ( win->prefetch, path, w, h, load );
+
+	if ( pixbuf ) image_cache_insert ( win->cache, path, w, h, pixbuf, load );
+
+	return pixbuf;
+}
+
+/* Fit zoom for the current box and orientation ( a quarter turn swaps the box ).
+   Returns TRUE when the box needs more pixels than the kept decode has. */
+static gboolean image_win_fit_zoom ( ImageWin *win )
+{
+	int w = 0, h = 0;
+	image_win_get_fit_size ( &w, &h, win );
 
-	if ( num == PHR ) pb = gdk_pixbuf_flip ( pbimage, TRUE  );
-	if ( num == PVT ) pb = gdk_pixbuf_flip ( pbimage, FALSE );
+	if ( w <= 0 || h <= 0 || ( !win->source && !win->vector ) || win->load.org_w <= 0 || win->load.org_h <= 0 ) return FALSE;
 
-	if ( num == PRT ) pb = gdk_pixbuf_rotate_simple ( pbimage, GDK_PIXBUF_ROTATE_CLOCKWISE );
-	if ( num == PLT ) pb = gdk_pixbuf_rotate_simple ( pbimage, GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE );
+	gboolean swap = ( image_win_get_orient ( win ) >= 5 );
 
-	gtk_image_set_from_pixbuf ( win->image, pb );
+	int org_w = ( swap ) ? win->load.org_h : win->load.org_w;
+	int org_h = ( swap ) ? win->load.org_w : win->load.org_h;
 
-	if ( pb ) g_object_unref ( pb );
+	double zoom = MIN ( (double)w / org_w, (double)h / org_h );
+
+	/* Vectors are rendered at any zoom: no decode to stay within */
+	if ( win->vector )
+	{
+		if ( zoom != image_view_get_zoom ( win->view ) ) image_view_set_zoom ( win->view, zoom, 0, 0 );
+
+		return FALSE;
+	}
+
+	int src_w = gdk_pixbuf_get_width ( win->source );
+
+	gboolean sharper = ( zoom * win->load.org_w > src_w + 1 && src_w < win->load.org_w && !win->streaming && !win->animated );
+
+	if ( !sharper && zoom * win->load.org_w + 1 >= src_w ) zoom = (double)src_w / win->load.org_w;
+
+	if ( zoom != image_view_get_zoom ( win->view ) ) image_view_set_zoom ( win->view, zoom, 0, 0 );
+
+	return sharper;
 }
 
-static void image_win_set_image ( ImageWin *win )
+static void image_win_sharp_cancel ( ImageWin *win )
 {
-	g_autofree char *path = g_file_get_path ( win->file );
+	image_stream_cancel ( win->sharp );
 
-	if ( path == NULL ) return;
+	win->sharp_w = 0;
+	win->sharp_h = 0;
+	win->sharp_fit = FALSE;
+}
 
-	int w = gtk_widget_get_allocated_width  ( GTK_WIDGET ( win ) );
-	int h = gtk_widget_get_allocated_height ( GTK_WIDGET ( win ) );
+/* A sharper decode of the image on show, off the main thread; the kept decode is drawn scaled meanwhile.
+   fit: a decode at the fit box, which goes to the cache and sets the fit zoom when it arrives. */
+static void image_win_sharpen ( const char *path, int w, int h, gboolean fit, ImageWin *win )
+{
+	ImageLoad load = win->load;
 
-	gboolean vis = gtk_widget_get_visible ( GTK_WIDGET ( win->bar_box ) );
+	win->sharp_w = w;
+	win->sharp_h = h;
+	win->sharp_fit = fit;
 
-	if ( vis )
+	image_stream_open ( win->sharp, path, w, h, &load );
+}
+
+/* Another file cancels it; dropped as well when the zoom went back to what the kept decode covers */
+static void image_win_sharp ( const char *path, GdkPixbuf *pixbuf, ImageLoad *load, G_GNUC_UNUSED gboolean done, ImageWin *win )
+{
+	int w = win->sharp_w, h = win->sharp_h;
+	gboolean fit = win->sharp_fit;
+
+	win->sharp_w = 0;
+	win->sharp_h = 0;
+	win->sharp_fit = FALSE;
+
+	if ( !pixbuf || !win->source || win->tiled || win->vector ) return;
+
+	int src_w = gdk_pixbuf_get_width ( win->source );
+
+	if ( gdk_pixbuf_get_width ( pixbuf ) <= src_w ) return;
+
+	if ( fit ) image_cache_insert ( win->cache, path, w, h, pixbuf, load );
+
+	if ( !fit && win->load.org_w * image_view_get_zoom ( win->view ) <= src_w ) return;
+
+	image_win_set_source ( pixbuf, load, TRUE, win );
+
+	if ( fit ) image_win_fit_zoom ( win );
+
+	image_win_set_label_zoom ( win );
+}
+
+/* Decode again at the grown box, once the resize has settled: from the cache, else on the worker */
+static gboolean image_win_fit_source ( ImageWin *win )
+{
+	win->src_fit = 0;
+
+	g_autofree char *path = ( win->file && !win->tiled && !win->original && !win->streaming && !win->animated ) ? g_file_get_path ( win->file ) : NULL;
+
+	if ( path == NULL ) return FALSE;
+
+	int w = 0, h = 0;
+	image_win_get_fit_size ( &w, &h, win );
+
+	gboolean swap = ( image_win_get_orient ( win ) >= 5 );
+
+	ImageLoad load = win->load;
+
+	GdkPixbuf *pixbuf = image_cache_lookup ( win->cache, path, ( swap ) ? h : w, ( swap ) ? w : h, &load );
+
+	if ( !pixbuf ) { image_win_sharpen ( path, ( swap ) ? h : w, ( swap ) ? w : h, TRUE, win ); return FALSE; }
+
+	image_win_set_source ( pixbuf, &load, TRUE, win );
+
+	g_object_unref ( pixbuf );
+
+	image_win_fit_zoom ( win );
+
+	image_win_set_label_zoom ( win );
+
+	return FALSE;
+}
+
+/* Resize, fullscreen, the bar and turns rescale the kept decode at once ( the view refines it );
+   the file is decoded again only when the box grows past that decode */
+static void image_win_refit ( ImageWin *win )
+{
+	if ( win->src_fit ) g_source_remove ( win->src_fit );
+
+	win->src_fit = 0;
+
+	if ( win->sharp_fit ) image_win_sharp_cancel ( win );
+
+	if ( image_win_fit_zoom ( win ) ) win->src_fit = g_timeout_add ( FIT_DECODE_MS, (GSourceFunc)image_win_fit_source, win );
+}
+
+static void image_win_show ( GdkPixbuf *pixbuf, ImageLoad *load, gboolean keep, ImageWin *win )
+{
+	image_win_set_source ( pixbuf, load, keep, win );
+
+	image_view_set_orient ( win->view, image_win_get_orient ( win ) );
+
+	image_win_refit ( win );
+
+	image_win_set_label_zoom ( win );
+}
+
+static void image_win_stream_keep ( ImageWin *win )
+{
+	if ( win->stream_prev ) g_object_unref ( win->stream_prev );
+
+	win->stream_prev = NULL;
+	win->stream_back = FALSE;
+}
+
+/* The decode failed before any pixels were shown: the view still shows the previous file ( or the previews ),
+   so that file becomes current again */
+static void image_win_stream_back ( ImageWin *win )
+{
+	GFile *file = win->file;
+
+	win->file = win->stream_prev;
+	win->stream_prev = NULL;
+	win->stream_back = FALSE;
+
+	if ( file ) g_object_unref ( file );
+
+	if ( !win->file || win->stream_prw )
 	{
-		int bar_h = gtk_widget_get_allocated_height ( GTK_WIDGET ( win->bar_box ) );
+		gtk_widget_set_visible ( GTK_WIDGET ( win->swin_img ), FALSE );
+		gtk_widget_set_visible ( GTK_WIDGET ( win->swin_prw ), TRUE  );
+	}
 
-		h -= bar_h;
+	g_autofree char *path = ( win->file ) ? g_file_get_path ( win->file ) : NULL;
+
+	uint c = 0;
+	if ( path && image_index_find ( win->index, path, &c ) ) image_win_prefetch ( c, FALSE, win );
+}
+
+/* Partial images while the worker decodes, then the result; the first one replaces the previous image */
+static void image_win_stream ( const char *path, GdkPixbuf *pixbuf, ImageLoad *load, gboolean done, ImageWin *win )
+{
+	if ( done ) win->streaming = FALSE;
+
+	if ( !pixbuf && done && !win->stream_shown && win->stream_back ) { image_win_stream_back ( win ); return; }
+
+	if ( !pixbuf ) return;
+
+	image_win_stream_keep ( win );
+
+	int64_t t = g_get_monotonic_time ();
+
+	if ( !win->stream_shown ) g_debug ( "%s:: first pixels %.2f ms%s :: %s", __func__, (double)( t - win->t_stream ) / 1000, ( done ) ? "" : ", partial", path );
+
+	image_win_show ( pixbuf, load, win->stream_shown, win );
+
+	win->stream_shown = TRUE;
+
+	if ( !done ) return;
+
+	image_cache_insert ( win->cache, path, win->stream_w, win->stream_h, pixbuf, load );
+
+	image_load_debug ( path, g_get_monotonic_time () - t, load );
+	image_cache_stats_dump ( win->cache );
+}
+
+/* SVG with librsvg: the view renders it at its zoom, nothing is decoded here */
+static gboolean image_win_set_vector ( const char *path, ImageLoad *load, ImageWin *win )
+{
+	if ( !g_str_equal ( load->format, "svg" ) || !image_view_open_svg ( win->view, path, load->org_w, load->org_h ) ) return FALSE;
+
+	image_win_set_source ( NULL, load, FALSE, win );
+
+	win->vector = TRUE;
+
+	image_view_set_orient ( win->view, image_win_get_orient ( win ) );
+
+	image_win_refit ( win );
+
+	image_win_set_label_zoom ( win );
+
+	return TRUE;
+}
+
+/* The first frame; the engine plays the rest into the view */
+static void image_win_anim ( GdkPixbuf *pixbuf, ImageLoad *load, ImageWin *win )
+{
+	if ( !pixbuf )
+	{
+		win->animated = FALSE;
+
+		if ( win->stream_back ) image_win_stream_back ( win );
+
+		return;
 	}
 
+	image_win_stream_keep ( win );
+
+	image_win_show ( pixbuf, load, FALSE, win );
+}
+
+/* Cached and prefetched images are shown at once, GIFs are played by the animation engine,
+   anything else is decoded on the stream worker */
+static gboolean image_win_set_image ( ImageWin *win )
+{
+	g_autofree char *path = ( win->file ) ? g_file_get_path ( win->file ) : NULL;
+
+	if ( path == NULL ) return FALSE;
+
+	image_stream_cancel ( win->stream );
+	image_win_sharp_cancel ( win );
+	image_anim_stop ( win->anim );
+
+	win->streaming = FALSE;
+	win->animated  = FALSE;
+
+	int w = 0, h = 0;
+	image_win_get_fit_size ( &w, &h, win );
+
+	ImageLoad load = { 0 };
 	GError *error = NULL;
-	GdkPixbuf *pbf_org = gdk_pixbuf_new_from_file ( path, &error );
 
-	if ( error )
+	/* The original size has to be known before any lookup: a very large image goes to tiles */
+	if ( win->original ) image_load_probe ( path, &load, &error );
+
+	GdkPixbuf *pixbuf = ( error ) ? NULL : image_win_take ( path, w, h, &load, &error, win );
+
+	if ( !pixbuf && !error && !load.org_w ) image_load_probe ( path, &load, &error );
+
+	if ( !error && image_win_set_vector ( path, &load, win ) )
 	{
-		g_warning ( "%s:: %s ", __func__, error->message );
+		if ( pixbuf ) g_object_unref ( pixbuf );
 
-		g_error_free ( error );
+		return TRUE;
+	}
 
-		return;
+	if ( !pixbuf && !error && win->original && (uint64_t)load.org_w * (uint64_t)load.org_h > TILES_PIXELS ) return image_win_set_tiled ( path, &load, win );
+
+	if ( !error && g_str_equal ( load.format, "gif" ) )
+	{
+		if ( pixbuf ) g_object_unref ( pixbuf );
+
+		win->animated = TRUE;
+
+		image_anim_open ( win->anim, path, w, h, &load );
+
+		return TRUE;
 	}
 
-	gtk_image_clear ( win->image );
+	if ( !pixbuf && !error )
+	{
+		win->streaming = TRUE;
+		win->stream_shown = FALSE;
+		win->stream_w = w;
+		win->stream_h = h;
+		win->t_stream = g_get_monotonic_time ();
+
+		image_stream_open ( win->stream, path, w, h, &load );
 
-	int pw = gdk_pixbuf_get_width  ( pbf_org );
-	int ph = gdk_pixbuf_get_height ( pbf_org );
+		return TRUE;
+	}
 
-	if ( win->original )
+	if ( !pixbuf )
 	{
-		image_win_set_label ( pw, ph, pw, ph, win );
-		gtk_image_set_from_file ( win->image, path ); g_object_unref ( pbf_org );
+		g_warning ( "%s:: %s ", __func__, ( error ) ? error->message : path );
 
-		if ( win->pb_type_lr != POR ) image_win_set_image_vhlr ( win->pb_type_lr, win );
-		if ( win->pb_type_hv != POR ) image_win_set_image_vhlr ( win->pb_type_hv, win );
+		if ( error ) g_error_free ( error );
 
-		return;
+		return FALSE;
 	}
 
-	int set_w = ( pw < w ) ? pw : w;
-	int set_h = ( ph < h ) ? ph : h;
+	int64_t t = g_get_monotonic_time ();
 
-	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_size ( path, set_w, set_h, NULL );
+	image_win_show ( pixbuf, &load, FALSE, win );
 
-	if ( pixbuf ) image_win_set_label ( pw, ph, set_w, set_h, win );
-	if ( pixbuf ) gtk_image_set_from_pixbuf ( win->image, pixbuf );
+	g_object_unref ( pixbuf );
 
-	if ( pixbuf  ) g_object_unref ( pixbuf ) ;
-	if ( pbf_org ) g_object_unref ( pbf_org );
+	image_load_debug ( path, g_get_monotonic_time () - t, &load );
+	image_cache_stats_dump ( win->cache );
 
-	if ( win->pb_type_lr != POR ) image_win_set_image_vhlr ( win->pb_type_lr, win );
-	if ( win->pb_type_hv != POR ) image_win_set_image_vhlr ( win->pb_type_hv, win );
+	return TRUE;
+}
+
+/* Zoom is a redraw of the kept decode; a sharper decode on the worker only when zooming in past it,
+   tiles once that decode would be larger than TILES_PIXELS */
+static void image_win_zoom ( double factor, double x, double y, ImageWin *win )
+{
+	if ( !win->tiled && !win->vector && !win->source ) return;
+
+	if ( win->src_fit ) g_source_remove ( win->src_fit );
+
+	win->src_fit = 0;
+
+	if ( win->sharp_fit ) image_win_sharp_cancel ( win );
+
+	double zoom_old = image_view_get_zoom ( win->view );
+	double zoom = CLAMP ( zoom_old * factor, 1.0 / 64, ( win->vector ) ? VECTOR_ZOOM_MAX : 8.0 );
+
+	int w = (int)( win->load.org_w * zoom );
+	int h = (int)( win->load.org_h * zoom );
+
+	if ( !win->tiled && ( w <= 16 || h <= 16 ) ) return;
+
+	int64_t t = g_get_monotonic_time ();
+
+	int src_w = ( win->source ) ? gdk_pixbuf_get_width  ( win->source ) : 0;
+	int src_h = ( win->source ) ? gdk_pixbuf_get_height ( win->source ) : 0;
+
+	if ( !win->tiled && !win->vector && !win->streaming && !win->animated && ( w > src_w || h > src_h ) && src_w < win->load.org_w )
+	{
+		g_autofree char *path = g_file_get_path ( win->file );
+
+		int dec_w = MIN ( win->load.org_w, w * 2 );
+		int dec_h = MIN ( win->load.org_h, h * 2 );
+
+		if ( (uint64_t)dec_w * (uint64_t)dec_h > TILES_PIXELS )
+		{
+			double hval = gtk_adjustment_get_value ( win->adjh );
+			double vval = gtk_adjustment_get_value ( win->adjv );
+
+			ImageLoad load = win->load;
+
+			image_win_sharp_cancel ( win );
+
+			image_win_set_tiled ( path, &load, win );
+
+			image_view_set_zoom ( win->view, zoom_old, 0, 0 );
+
+			gtk_adjustment_set_value ( win->adjh, hval );
+			gtk_adjustment_set_value ( win->adjv, vval );
+		}
+		else if ( dec_w > win->sharp_w || dec_h > win->sharp_h )
+			image_win_sharpen ( path, dec_w, dec_h, FALSE, win );
+	}
+
+	image_view_set_zoom ( win->view, zoom, x, y );
+
+	image_win_set_label_zoom ( win );
+
+	g_debug ( "%s:: %.0f%%, %.2f ms", __func__, zoom * 100, (double)( g_get_monotonic_time () - t ) / 1000 );
+}
+
+static void image_win_zoom_center ( double factor, ImageWin *win )
+{
+	int w = gtk_widget_get_allocated_width  ( GTK_WIDGET ( win->swin_img ) );
+	int h = gtk_widget_get_allocated_height ( GTK_WIDGET ( win->swin_img ) );
+
+	image_win_zoom ( factor, w / 2.0, h / 2.0, win );
 }
 
 static void image_set_file ( GFile *file, ImageWin *win )
 {
 	g_autofree char *path_new = NULL;
 
-	win->pb_type_lr = POR;
-	win->pb_type_hv = POR;
+	win->orient = 1;
 
 	if ( file ) path_new = g_file_get_path ( file );
 
 	if ( !path_new ) return;
 
-	gboolean check_pb = image_win_check_pixbuf ( path_new );
+	GFile *file_old = win->file;
 
-	if ( check_pb )
+	gboolean prw = gtk_widget_get_visible ( GTK_WIDGET ( win->swin_prw ) );
+
+	win->file = g_file_parse_name ( path_new );
+
+	if ( image_win_set_image ( win ) )
 	{
 		gtk_widget_set_visible ( GTK_WIDGET ( win->swin_img ), TRUE  );
 		gtk_widget_set_visible ( GTK_WIDGET ( win->swin_prw ), FALSE );
 
-		if ( win->file ) g_object_unref ( win->file );
+		/* Until the stream or the animation shows pixels the view still shows file_old: kept to go back to if the decode fails */
+		gboolean pending = ( win->streaming || win->animated );
 
-		win->file = g_file_parse_name ( path_new );
+		if ( pending && !win->stream_back )
+		{
+			win->stream_prev = file_old;
+			win->stream_prw  = prw;
+			win->stream_back = TRUE;
 
-		image_win_set_image ( win );
+			file_old = NULL;
+		}
+		else if ( !pending )
+			image_win_stream_keep ( win );
+
+		if ( file_old ) g_object_unref ( file_old );
+	}
+	else
+	{
+		g_object_unref ( win->file );
+
+		win->file = file_old;
+
+		/* The stream that was to replace the shown file has been cancelled as well */
+		if ( win->stream_back ) image_win_stream_back ( win );
 	}
 }
 
-static void image_win_left ( ImageWin *win )
+/* Turns and flips compose; the view applies the result at draw time */
+static void image_win_orient ( enum orient_enm turn, ImageWin *win )
 {
-	win->pb_type_lr = ( win->pb_type_lr == POR ) ? PLT : POR;
+	win->orient = image_ops_orient_compose ( win->orient, (uint8_t)turn );
+
+	image_view_set_orient ( win->view, image_win_get_orient ( win ) );
 
-	image_win_set_image_vhlr ( PLT, win );
+	image_win_refit ( win );
+
+	image_win_set_label_zoom ( win );
 }
 
-static void image_win_right ( ImageWin *win )
+static void image_win_left ( ImageWin *win )
 {
-	win->pb_type_lr = ( win->pb_type_lr == POR ) ? PRT : POR;
+	image_win_orient ( ORIENT_LT, win );
+}
 
-	image_win_set_image_vhlr ( PRT, win );
+static void image_win_right ( ImageWin *win )
+{
+	image_win_orient ( ORIENT_RT, win );
 }
 
 static void image_win_vertical ( ImageWin *win )
 {
-	win->pb_type_hv = ( win->pb_type_hv == POR ) ? PVT : POR;
-
-	image_win_set_image_vhlr ( PVT, win );
+	image_win_orient ( ORIENT_VT, win );
 }
 
 static void image_win_horizont ( ImageWin *win )
 {
-	win->pb_type_hv = ( win->pb_type_hv == POR ) ? PHR : POR;
-
-	image_win_set_image_vhlr ( PHR, win );
+	image_win_orient ( ORIENT_HR, win );
 }
 
 static void image_win_inp ( ImageWin *win )
 {
-	image_win_set_image_plus_minus ( TRUE, win );
+	image_win_zoom_center ( 1.25, win );
 }
 
 static void image_win_out ( ImageWin *win )
 {
-	image_win_set_image_plus_minus ( FALSE, win );
+	image_win_zoom_center ( 0.8, win );
 }
 
 static void image_win_fit ( ImageWin *win )
@@ -478,84 +889,59 @@ static void image_win_org ( ImageWin *win )
 	image_win_set_image ( win );
 }
 
-static int image_sort_func_list ( gconstpointer a, gconstpointer b )
+static void image_win_prefetch ( uint cur, gboolean reverse, ImageWin *win )
 {
-	g_autofree char *na = g_utf8_collate_key_for_filename ( a, -1 );
-	g_autofree char *nb = g_utf8_collate_key_for_filename ( b, -1 );
-
-	return g_strcmp0 ( na, nb );
-}
+	uint num = image_index_get_len ( win->index );
+	uint8_t depth = image_prefetch_get_depth ( win->prefetch );
 
-static char * image_win_list_sort_get_data ( const char *path, gboolean reverse, GList *list )
-{
-	char *data = NULL;
-	gboolean found = FALSE;
+	int w = 0, h = 0;
+	image_win_get_fit_size ( &w, &h, win );
 
-	GList *list_sort = g_list_sort ( list, image_sort_func_list );
+	GPtrArray *paths = g_ptr_array_new ();
 
-	if ( reverse ) list_sort = g_list_reverse ( list_sort );
+	/* Already decoded images ( the one just left when flipping back and forth ) are not decoded again */
+	uint8_t c = 0; for ( c = 1; c <= depth && c < num; c++ )
+	{
+		const char *path = image_index_get_path ( win->index, ( reverse ) ? ( cur + num - c ) % num : ( cur + c ) % num );
 
-	char *data_0 = (char *)g_list_nth ( list_sort, 0 )->data;
+		if ( !image_cache_contains ( win->cache, path, w, h ) ) g_ptr_array_add ( paths, (char *)path );
+	}
 
-	while ( list_sort != NULL )
+	for ( c = 1; c <= depth && c < num; c++ )
 	{
-		data = (char *)list_sort->data;
+		const char *path = image_index_get_path ( win->index, ( reverse ) ? ( cur + c ) % num : ( cur + num - c ) % num );
 
-		if ( !path || found ) break;
+		uint8_t i = 0; for ( i = 0; i < paths->len; i++ ) if ( g_ptr_array_index ( paths, i ) == path ) break;
 
-		if ( path && g_str_has_suffix ( path, data ) ) found = TRUE;
-
-		list_sort = list_sort->next;
+		if ( i == paths->len && !image_cache_contains ( win->cache, path, w, h ) ) g_ptr_array_add ( paths, (char *)path );
 	}
 
-	return ( list_sort ) ? data : data_0;
+	image_prefetch_request ( win->prefetch, paths, w, h, reverse );
+
+	g_ptr_array_unref ( paths );
 }
 
 static void image_win_dir ( const char *dir_path, const char *path, gboolean reverse, ImageWin *win )
 {
-	GList *list = NULL;
-	GDir *dir = g_dir_open ( dir_path, 0, NULL );
-
-	if ( dir )
-	{
-		const char *name = NULL;
+	if ( image_index_open ( win->index, dir_path ) ) image_prefetch_cancel ( win->prefetch );
 
-		while ( ( name = g_dir_read_name ( dir ) ) != NULL )
-		{
-			char *path_name = g_strconcat ( dir_path, "/", name, NULL );
-
-			if ( path_name && g_file_test ( path_name, G_FILE_TEST_IS_REGULAR ) )
-			{
-				list = g_list_append ( list, g_strdup ( path_name ) );
-			}
-
-			free ( path_name );
-		}
+	uint num = image_index_get_len ( win->index );
 
-		g_dir_close ( dir );
-	}
-	else
+	if ( num > 1 )
 	{
-		g_critical ( "%s: opening directory %s failed.", __func__, dir_path );
-	}
+		uint c = 0;
+		gboolean found = ( path && image_index_find ( win->index, path, &c ) );
 
-	if ( list )
-	{
-		uint num = g_list_length ( list );
+		uint next = ( found ) ? ( ( reverse ) ? c + num - 1 : c + 1 ) % num : ( ( reverse ) ? c + num - 1 : c ) % num;
 
-		if ( num > 1 )
-		{
-			char *path_new = image_win_list_sort_get_data ( path, reverse, list );
+		GFile *file = g_file_parse_name ( image_index_get_path ( win->index, next ) );
 
-			GFile *file = g_file_parse_name ( path_new );
+		if ( file ) image_set_file ( file, win );
 
-			if ( file ) image_set_file ( file, win );
+		if ( file ) g_object_unref ( file );
 
-			if ( file ) g_object_unref ( file );
-		}
+		image_win_prefetch ( next, reverse, win );
 	}
-
-	g_list_free_full ( list, (GDestroyNotify) g_free );
 }
 
 static void image_win_back ( ImageWin *win )
@@ -581,30 +967,68 @@ static void image_win_stop ( ImageWin *win )
 	GtkImage *image = (GtkImage *)gtk_button_get_image ( win->button_play );
 	gtk_image_set_from_icon_name ( image, "media-playback-start", GTK_ICON_SIZE_MENU );
 
-	if ( win->src_play ) g_source_remove ( win->src_play );
+	image_slide_stop ( win->slide );
+}
+
+/* The index of the shown file; FALSE without a file or a second image to go to */
+static gboolean image_win_slide_index ( uint *c, ImageWin *win )
+{
+	g_autofree char *path = ( win->file ) ? g_file_get_path ( win->file ) : NULL;
 
-	win->src_play = 0;
+	return ( path && image_index_get_len ( win->index ) > 1 && image_index_find ( win->index, path, c ) );
 }
 
-static gboolean image_win_time_autoplay ( ImageWin *win )
+/* Queues index + 1 at the current fit size, nearest first */
+static void image_win_slide_prefetch ( ImageWin *win )
+{
+	uint c = 0;
+
+	if ( image_win_slide_index ( &c, win ) ) image_win_prefetch ( c, FALSE, win );
+}
+
+static gboolean image_win_slide_next ( ImageWin *win )
 {
 	gboolean vis = gtk_widget_get_visible ( GTK_WIDGET ( win->swin_prw ) );
 
-	if ( vis ) { image_win_stop ( win ); return FALSE; }
+	if ( vis || !win->file ) { image_win_stop ( win ); return FALSE; }
 
 	image_win_forward ( win );
 
+	image_win_slide_prefetch ( win );
+
 	return TRUE;
 }
 
+/* The image after the current one has to be cached or decoded ahead; the change waits for it */
+static gboolean image_win_slide_ready ( ImageWin *win )
+{
+	uint c = 0;
+
+	if ( !image_win_slide_index ( &c, win ) ) return TRUE;
+
+	int w = 0, h = 0;
+	image_win_get_fit_size ( &w, &h, win );
+
+	const char *next = image_index_get_path ( win->index, ( c + 1 ) % image_index_get_len ( win->index ) );
+
+	if ( image_cache_contains ( win->cache, next, w, h ) || image_prefetch_ready ( win->prefetch, next, w, h ) ) return TRUE;
+
+	/* Nothing queued at this size ( the window was resized ): queue it now */
+	if ( !image_prefetch_pending ( win->prefetch, next, w, h ) ) image_win_prefetch ( c, FALSE, win );
+
+	return FALSE;
+}
+
 static void image_win_run_autoplay ( ImageWin *win )
 {
-	win->src_play = g_timeout_add_seconds ( win->timeout, (GSourceFunc)image_win_time_autoplay, win );
+	image_win_slide_prefetch ( win );
+
+	image_slide_start ( win->slide, win->timeout );
 }
 
 static void image_win_play ( ImageWin *win )
 {
-	if ( win->src_play )
+	if ( image_slide_is_running ( win->slide ) )
 		image_win_stop ( win );
 	else
 	{
@@ -744,13 +1168,6 @@ static gboolean image_win_fullscreen ( ImageWin *win )
 	return TRUE;
 }
 
-static gboolean image_win_time_update ( ImageWin *win )
-{
-	image_win_set_image ( win );
-
-	return FALSE;
-}
-
 static gboolean image_win_press_event ( G_GNUC_UNUSED GtkScrolledWindow *swin, GdkEventButton *event, ImageWin *win )
 {
 	gboolean vis = gtk_widget_get_visible ( GTK_WIDGET ( win->swin_prw ) );
@@ -762,12 +1179,7 @@ static gboolean image_win_press_event ( G_GNUC_UNUSED GtkScrolledWindow *swin, G
 		win->ah_val = gtk_adjustment_get_value ( win->adjh ) + event->x;
 		win->av_val = gtk_adjustment_get_value ( win->adjv ) + event->y;
 
-		if ( event->type == GDK_2BUTTON_PRESS )
-		{
-			image_win_fullscreen ( win );
-
-			g_timeout_add ( 250, (GSourceFunc)image_win_time_update, win );
-		}
+		if ( event->type == GDK_2BUTTON_PRESS ) image_win_fullscreen ( win );
 	}
 
 	if ( event->button == GDK_BUTTON_MIDDLE )
@@ -782,8 +1194,6 @@ static gboolean image_win_press_event ( G_GNUC_UNUSED GtkScrolledWindow *swin, G
 		gboolean set = gtk_widget_get_visible ( GTK_WIDGET ( win->bar_box ) );
 
 		gtk_widget_set_visible ( GTK_WIDGET ( win->bar_box ), !set );
-
-		image_win_set_image ( win );
 	}
 
 	return GDK_EVENT_STOP;
@@ -809,57 +1219,67 @@ static gboolean image_win_notify_event ( GtkScrolledWindow *swin, GdkEventMotion
 	return GDK_EVENT_STOP;
 }
 
-static gboolean image_win_config_timeout ( ImageWin *win )
+static void image_win_view_allocate ( G_GNUC_UNUSED ImageView *view, G_GNUC_UNUSED GdkRectangle *alloc, ImageWin *win )
 {
-	win->config = TRUE;
+	if ( win->tiled || win->original || ( !win->source && !win->vector ) ) return;
 
-	image_win_set_image ( win );
+	image_win_refit ( win );
 
-	return FALSE;
+	image_win_set_label_zoom ( win );
 }
 
-static gboolean image_win_config_event ( G_GNUC_UNUSED GtkWindow *window, G_GNUC_UNUSED GdkEventConfigure *event, ImageWin *win )
+static gboolean image_win_scroll_event ( G_GNUC_UNUSED GtkWindow *window, GdkEventScroll *evscroll, ImageWin *win )
 {
 	gboolean vis = gtk_widget_get_visible ( GTK_WIDGET ( win->swin_img ) );
 
-	if ( vis && win->config ) { win->config = FALSE; g_timeout_add ( 200, (GSourceFunc)image_win_config_timeout, win ); }
+	if ( !vis ) return GDK_EVENT_STOP;
 
-	return GDK_EVENT_PROPAGATE;
+	if ( evscroll->direction == GDK_SCROLL_UP   ) image_win_back ( win );
+	if ( evscroll->direction == GDK_SCROLL_DOWN ) image_win_forward ( win );
+
+	return GDK_EVENT_STOP;
 }
 
-static gboolean image_win_scroll_event ( G_GNUC_UNUSED GtkWindow *window, GdkEventScroll *evscroll, ImageWin *win )
+/* Ctrl+scroll zooms around the pointer; plain scroll is left to the window */
+static gboolean image_win_zoom_scroll_event ( GtkScrolledWindow *swin, GdkEventScroll *evscroll, ImageWin *win )
 {
-	gboolean vis = gtk_widget_get_visible ( GTK_WIDGET ( win->swin_img ) );
+	if ( !( evscroll->state & GDK_CONTROL_MASK ) ) return GDK_EVENT_PROPAGATE;
 
-	if ( !vis ) return GDK_EVENT_STOP;
+	if ( evscroll->direction != GDK_SCROLL_UP && evscroll->direction != GDK_SCROLL_DOWN ) return GDK_EVENT_STOP;
 
-	if ( evscroll->direction == GDK_SCROLL_UP   ) image_win_back ( win );
-	if ( evscroll->direction == GDK_SCROLL_DOWN ) image_win_forward ( win );
+	int x = 0, y = 0;
+	gdk_window_get_device_position ( gtk_widget_get_window ( GTK_WIDGET ( win ) ), evscroll->device, &x, &y, NULL );
+
+	int sx = 0, sy = 0;
+	gtk_widget_translate_coordinates ( GTK_WIDGET ( win ), GTK_WIDGET ( swin ), x, y, &sx, &sy );
+
+	image_win_zoom ( ( evscroll->direction == GDK_SCROLL_UP ) ? 1.1 : 1 / 1.1, sx, sy, win );
 
 	return GDK_EVENT_STOP;
 }
 
+/* COL_KEY points into win->keys: no copies and no collate key computations while sorting */
 static int icon_sort_func_az ( GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, G_GNUC_UNUSED gpointer data )
 {
-	int ret = 1;
 	gboolean is_dir_a, is_dir_b;
+	const char *key_a = NULL, *key_b = NULL;
 
-	g_autofree char *name_a = NULL;
-	g_autofree char *name_b = NULL;
+	gtk_tree_model_get ( model, a, COL_IS_DIR, &is_dir_a, COL_KEY, &key_a, -1 );
+	gtk_tree_model_get ( model, b, COL_IS_DIR, &is_dir_b, COL_KEY, &key_b, -1 );
 
-	gtk_tree_model_get ( model, a, COL_IS_DIR, &is_dir_a, COL_NAME, &name_a, -1 );
-	gtk_tree_model_get ( model, b, COL_IS_DIR, &is_dir_b, COL_NAME, &name_b, -1 );
+	if ( is_dir_a != is_dir_b ) return ( is_dir_a ) ? -1 : 1;
 
-	if ( !is_dir_a && is_dir_b )
-		ret = 1;
-	else if ( is_dir_a && !is_dir_b )
-		ret = -1;
-	else
+	int ret = g_strcmp0 ( key_a, key_b );
+
+	if ( ret == 0 )
 	{
-		g_autofree char *na = g_utf8_collate_key_for_filename ( name_a, -1 );
-		g_autofree char *nb = g_utf8_collate_key_for_filename ( name_b, -1 );
+		g_autofree char *name_a = NULL;
+		g_autofree char *name_b = NULL;
+
+		gtk_tree_model_get ( model, a, COL_NAME, &name_a, -1 );
+		gtk_tree_model_get ( model, b, COL_NAME, &name_b, -1 );
 
-		ret = g_strcmp0 ( na, nb );
+		ret = g_strcmp0 ( name_a, name_b );
 	}
 
 	return ret;
@@ -867,7 +1287,8 @@ static int icon_sort_func_az ( GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter
 
 static GtkTreeModel * icon_create_model ( void )
 {
-	GtkListStore *store = gtk_list_store_new ( NUM_COLS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, GDK_TYPE_PIXBUF );
+	GtkListStore *store = gtk_list_store_new ( NUM_COLS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, GDK_TYPE_PIXBUF, 
+		G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_ICON, G_TYPE_INT64, G_TYPE_UINT64 );
 
 	gtk_tree_sortable_set_default_sort_func ( GTK_TREE_SORTABLE ( store ), icon_sort_func_az, NULL, NULL );
 	gtk_tree_sortable_set_sort_column_id ( GTK_TREE_SORTABLE (store), GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID, GTK_SORT_ASCENDING );
@@ -894,377 +1315,453 @@ static GtkIconView * icon_view_create ( void )
 	return icon_view;
 }
 
-static inline GIcon * icon_emblemed_icon ( const char *name_1, const char *name_2, GIcon *gicon )
+/* Main thread only: everything a non-image row needs comes from the enumeration */
+static GdkPixbuf * icon_get_icon_pixbuf ( GIcon *gicon, const char *content_type, gboolean is_dir, gboolean is_link, uint16_t icon_size )
 {
-	GIcon *e_icon = g_themed_icon_new ( name_1 );
-	GEmblem *emblem  = g_emblem_new ( e_icon );
+	GdkPixbuf *pixbuf = image_icon_get ( gicon, content_type, is_link, icon_size );
 
-	GIcon *emblemed  = g_emblemed_icon_new ( gicon, emblem );
+	if ( !pixbuf ) pixbuf = image_icon_get_name ( ( is_dir ) ? "folder" : "unknown", icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR );
 
-	if ( name_2 )
-	{
-		GIcon *e_icon_2 = g_themed_icon_new ( name_2 );
-		GEmblem *emblem_2  = g_emblem_new ( e_icon_2 );
+	return pixbuf;
+}
 
-		g_emblemed_icon_add_emblem ( G_EMBLEMED_ICON ( emblemed ), emblem_2 );
+static inline gboolean icon_is_image ( const char *content_type )
+{
+	return ( content_type && g_str_has_prefix ( content_type, "image" ) );
+}
 
-		g_object_unref ( e_icon_2 );
-		g_object_unref ( emblem_2 );
-	}
+static uint16_t icon_get_vis_items ( ImageWin *win )
+{
+	int w = gtk_widget_get_allocated_width  ( GTK_WIDGET ( win->icon_view ) );
+	int h = gtk_widget_get_allocated_height ( GTK_WIDGET ( win->icon_view ) );
 
-	g_object_unref ( e_icon );
-	g_object_unref ( emblem );
+	int item_col_s = gtk_icon_view_get_column_spacing ( win->icon_view );
+	int item_width = gtk_icon_view_get_item_width ( win->icon_view );
+
+	uint16_t ch = (uint16_t)( h / ( item_width - 20 ) );
+	uint16_t cw = (uint16_t)( w / ( item_width + item_col_s ) );
+
+	uint16_t items = (uint16_t)( cw * ch );
 
-	return emblemed;
+	items *= 2;
+
+	return items;
 }
 
-static inline GdkPixbuf * icon_image_get_pixbuf ( const char *path, gboolean is_link, uint16_t icon_size, GFile *file )
+static void icon_thumb_push ( uint index, GtkTreeModel *model, ImageWin *win )
 {
-	GdkPixbuf *pixbuf = NULL;
+	if ( index >= win->thumb_rows || win->thumb_state[index] != THUMB_NONE ) return;
 
-	if ( is_link )
-	{
-		GIcon *gicon = g_file_icon_new ( file ), *emblemed = icon_emblemed_icon ( "emblem-symbolic-link", NULL, gicon );
-		GtkIconInfo *icon_info = gtk_icon_theme_lookup_by_gicon ( gtk_icon_theme_get_default (), emblemed, icon_size, GTK_ICON_LOOKUP_FORCE_SIZE );
+	GtkTreeIter iter;
 
-		if ( icon_info ) pixbuf = gtk_icon_info_load_icon ( icon_info, NULL );
+	if ( !gtk_tree_model_iter_nth_child ( model, &iter, NULL, (int)index ) ) return;
+
+	int64_t mtime = 0;
+	uint64_t file_size = 0;
+	gboolean is_link = FALSE;
+	g_autofree char *path = NULL;
 
-		if ( gicon ) g_object_unref ( gicon );
-		if ( emblemed ) g_object_unref ( emblemed );
-		if ( icon_info ) g_object_unref ( icon_info );
+	gtk_tree_model_get ( model, &iter, COL_PATH, &path, COL_IS_LINK, &is_link, COL_MTIME, &mtime, COL_SIZE, &file_size, -1 );
+
+	ThumbJob *job = image_thumb_job_new ( path, win->icon_size, is_link, win->thumb_cancel );
+
+	job->index  = index;
+	job->serial = win->thumb_serial;
+	job->mtime  = mtime;
+	job->file_size = file_size;
+
+	win->thumb_state[index] = THUMB_QUEUED;
+	win->thumb_left++;
+
+	image_thumb_pool_push ( win->thumb_pool, win->thumb_client, job );
+}
+
+/* The rest of the directory, outwards from the viewport, a few jobs at a time */
+static void icon_thumb_fill ( GtkTreeModel *model, ImageWin *win )
+{
+	while ( win->thumb_left < THUMB_QUEUE && ( win->thumb_fwd < win->thumb_rows || win->thumb_back > 0 ) )
+	{
+		if ( win->thumb_fwd < win->thumb_rows ) icon_thumb_push ( win->thumb_fwd++, model, win );
+		if ( win->thumb_back > 0 ) icon_thumb_push ( --win->thumb_back, model, win );
 	}
-	else
-		pixbuf = gdk_pixbuf_new_from_file_at_size ( path, icon_size, icon_size, NULL );
+}
 
-	return pixbuf;
+static void icon_thumb_free_list ( ThumbJob *job )
+{
+	while ( job ) { ThumbJob *next = job->next; image_thumb_job_free ( job ); job = next; }
 }
 
-static inline GtkIconInfo * icon_get_icon_info ( const char *content_type, gboolean is_link, uint16_t icon_size, GFileInfo *finfo )
+static void icon_thumb_progress ( ImageWin *win )
 {
-	GtkIconInfo *icon_info = NULL;
+	char text[64];
+	sprintf ( text, "%u / %u", win->thumb_done, win->thumb_rows );
 
-	GtkIconTheme *icon_theme = gtk_icon_theme_get_default ();
-	GIcon *unknown = NULL, *emblemed = NULL, *gicon = g_file_info_get_icon ( finfo );
+	gtk_label_set_text ( win->bar_label, text );
+}
 
-	if ( gicon )
-	{
-		if ( is_link ) emblemed = icon_emblemed_icon ( "emblem-symbolic-link", NULL, gicon );
+/*
+* Once per frame: finished jobs go into the model in place, within THUMB_FRAME_US,
+* the rest waits for the next frame. Rows are only updated, never replaced,
+* so scroll position and selection stay as they are.
+*/
+static gboolean icon_thumb_tick ( G_GNUC_UNUSED GtkWidget *widget, G_GNUC_UNUSED GdkFrameClock *clock, ImageWin *win )
+{
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
 
-		icon_info = gtk_icon_theme_lookup_by_gicon ( icon_theme, ( is_link ) ? emblemed : gicon, icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR );
-	}
+	ThumbJob *job = image_thumb_client_drain ( win->thumb_client );
 
-	if ( !icon_info && is_link )
+	if ( win->thumb_pending )
 	{
-		unknown = g_themed_icon_new ( "unknown" );
+		ThumbJob *tail = win->thumb_pending;
 
-		if ( emblemed ) g_object_unref ( emblemed );
+		while ( tail->next ) tail = tail->next;
 
-		if ( content_type && g_str_has_prefix ( content_type, "inode/symlink" ) ) 
-			emblemed = icon_emblemed_icon ( "dialog-error", "emblem-symbolic-link", unknown );
-		else
-			emblemed = icon_emblemed_icon ( "emblem-symbolic-link", NULL, unknown );
-
-		icon_info = gtk_icon_theme_lookup_by_gicon ( icon_theme, emblemed, icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR );
+		tail->next = job;
+		job = win->thumb_pending;
 	}
 
-	if ( unknown ) g_object_unref ( unknown );
-	if ( emblemed ) g_object_unref ( emblemed );
+	uint done = win->thumb_done;
+	int64_t t_end = g_get_monotonic_time () + THUMB_FRAME_US;
 
-	return icon_info;
-}
+	ThumbJob *next = NULL;
 
-static GdkPixbuf * icon_get_pixbuf ( const char *path, gboolean is_link, uint16_t icon_size )
-{
-	GdkPixbuf *pixbuf = NULL;
+	for ( ; job && g_get_monotonic_time () < t_end; job = next )
+	{
+		next = job->next;
 
-	GFile *file = g_file_new_for_path ( path );
-	GFileInfo *finfo = g_file_query_info ( file, "*", 0, NULL, NULL );
+		if ( job->cancel == win->thumb_cancel ) win->thumb_left--;
 
-	gboolean is_dir = g_file_test ( path, G_FILE_TEST_IS_DIR );
-	const char *content_type = ( finfo ) ? g_file_info_get_content_type ( finfo ) : NULL;
+		if ( job->serial == win->thumb_serial && job->index < win->thumb_rows && win->thumb_state[job->index] != THUMB_DONE )
+		{
+			GtkTreeIter iter;
 
-	if ( content_type && g_str_has_prefix ( content_type, "image" ) ) pixbuf = icon_image_get_pixbuf ( path, is_link, icon_size, file );
+			if ( !job->pixbuf && job->cancel == win->thumb_cancel )
+				job->pixbuf = image_icon_get_name ( "image-missing", win->icon_size, GTK_ICON_LOOKUP_FORCE_SIZE );
 
-	if ( finfo && !pixbuf )
-	{
-		GtkIconInfo *icon_info = icon_get_icon_info ( content_type, is_link, icon_size, finfo );
+			if ( job->pixbuf && gtk_tree_model_iter_nth_child ( model, &iter, NULL, (int)job->index ) )
+				gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_IS_PIXBUF, TRUE, COL_PIXBUF, job->pixbuf, -1 );
 
-		if ( icon_info ) pixbuf = gtk_icon_info_load_icon ( icon_info, NULL );
+			if ( job->pixbuf || job->cancel == win->thumb_cancel ) { win->thumb_state[job->index] = THUMB_DONE; win->thumb_done++; }
+		}
 
-		if ( icon_info ) g_object_unref ( icon_info );
+		image_thumb_job_free ( job );
 	}
 
-	if ( finfo ) g_object_unref ( finfo );
-	if ( file  ) g_object_unref ( file  );
+	win->thumb_pending = job;
 
-	if ( !pixbuf ) pixbuf = gtk_icon_theme_load_icon ( gtk_icon_theme_get_default (), ( is_dir ) ? "folder" : "unknown", icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
+	icon_thumb_fill ( model, win );
 
-	return pixbuf;
-}
+	if ( done != win->thumb_done ) icon_thumb_progress ( win );
 
-static void icon_set_pixbuf ( uint16_t icon_size, GtkTreeIter iter, GtkTreeModel *model )
-{
-	gboolean is_link = FALSE;
-	g_autofree char *path = NULL;
-	gtk_tree_model_get ( model, &iter, COL_PATH, &path, COL_IS_LINK, &is_link, -1 );
+	if ( win->thumb_left || win->thumb_pending ) return G_SOURCE_CONTINUE;
 
-	if ( g_file_test ( path, G_FILE_TEST_EXISTS ) )
-	{
-		GdkPixbuf *pixbuf = icon_get_pixbuf ( path, is_link, icon_size );
+	if ( win->thumb_done == win->thumb_rows ) image_load_stats_dump ( "thumbnails", win->thumb_rows );
 
-		if ( pixbuf ) gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_IS_PIXBUF, TRUE, COL_PIXBUF, pixbuf, -1 );
+	win->tick_thumb = 0;
 
-		if ( pixbuf ) g_object_unref ( pixbuf );
-	}
+	return G_SOURCE_REMOVE;
 }
 
-static gpointer icon_update_pixbuf_thread ( ImageWin *win )
+/* Visible items first, then a margin of one screen around them; queued work elsewhere is dropped */
+static gboolean icon_thumb_rank ( ImageWin *win )
 {
-	GtkTreeModel *model = win->model_t;
+	win->src_rank = 0;
 
-	gboolean break_t = FALSE;
-	uint64_t num = 0, end = win->end_t;
-	uint16_t icon_size = win->icon_size;
-	uint8_t mod = win->mod_t, limit = win->limit_t;
+	if ( !win->thumb_rows ) return FALSE;
 
-	GtkTreeIter iter;
-	gboolean valid = FALSE;
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+	GtkTreePath *start = NULL, *end = NULL;
+
+	uint first = 0, last = MIN ( MAX ( icon_get_vis_items ( win ), 1 ), win->thumb_rows ) - 1;
 
-	for ( valid = gtk_tree_model_get_iter_first ( model, &iter ); valid; valid = gtk_tree_model_iter_next ( model, &iter ) )
+	if ( gtk_icon_view_get_visible_range ( win->icon_view, &start, &end ) )
 	{
-		G_LOCK ( done_th );
-			if ( win->break_t ) break_t = TRUE;
-		G_UNLOCK ( done_th );
+		first = (uint)gtk_tree_path_get_indices ( start )[0];
+		last  = (uint)gtk_tree_path_get_indices ( end   )[0];
+
+		gtk_tree_path_free ( start );
+		gtk_tree_path_free ( end   );
+	}
 
-		if ( break_t ) return NULL;
+	g_cancellable_cancel ( win->thumb_cancel );
+	g_object_unref ( win->thumb_cancel );
 
-		if ( ( !limit && num > end ) || ( limit && num < end ) ) { num++; continue; }
+	win->thumb_cancel = g_cancellable_new ();
+	win->thumb_left = 0;
 
-		if (  mod && !( num % 2 ) ) { num++; continue; }
-		if ( !mod &&  ( num % 2 ) ) { num++; continue; }
+	uint c = 0; for ( c = 0; c < win->thumb_rows; c++ ) if ( win->thumb_state[c] == THUMB_QUEUED ) win->thumb_state[c] = THUMB_NONE;
 
-		gboolean is_pb = FALSE;
-		gtk_tree_model_get ( model, &iter, COL_IS_PIXBUF, &is_pb, -1 );
+	for ( c = first; c <= last; c++ ) icon_thumb_push ( c, model, win );
 
-		if ( !is_pb ) icon_set_pixbuf ( icon_size, iter, model );
+	uint margin = last - first + 1;
 
-		num++;
+	for ( c = 1; c <= margin; c++ )
+	{
+		icon_thumb_push ( last + c, model, win );
+
+		if ( first >= c ) icon_thumb_push ( first - c, model, win );
 	}
 
-	G_LOCK ( done_th );
+	win->thumb_fwd  = MIN ( last + margin + 1, win->thumb_rows );
+	win->thumb_back = ( first > margin ) ? first - margin : 0;
 
-	if ( !mod && !limit ) win->done_t_0 = TRUE;
-	if (  mod && !limit ) win->done_t_1 = TRUE;
-	if ( !mod &&  limit ) win->done_t_2 = TRUE;
-	if (  mod &&  limit ) win->done_t_3 = TRUE;
+	icon_thumb_fill ( model, win );
 
-	G_UNLOCK ( done_th );
+	if ( win->thumb_left && !win->tick_thumb ) win->tick_thumb = gtk_widget_add_tick_callback ( GTK_WIDGET ( win->icon_view ), (GtkTickCallback)icon_thumb_tick, win, NULL );
 
-	return NULL;
+	return FALSE;
 }
 
-static gboolean icon_update_pixbuf_timeout ( ImageWin *win )
+static void icon_thumb_scroll ( G_GNUC_UNUSED GtkAdjustment *adj, ImageWin *win )
 {
-	if ( !GTK_IS_WIDGET ( win->icon_view ) ) return FALSE;
+	if ( win->thumb_rows && !win->src_rank ) win->src_rank = g_timeout_add ( 50, (GSourceFunc)icon_thumb_rank, win );
+}
 
-	if ( win->break_t ) { g_usleep ( 100000 ); g_object_unref ( win->model_t ); win->model_t = NULL; return FALSE; }
+static void icon_thumb_cancel ( ImageWin *win )
+{
+	g_cancellable_cancel ( win->thumb_cancel );
+	g_object_unref ( win->thumb_cancel );
 
-	if ( win->done_t_0 && win->done_t_1 && win->done_t_2 && win->done_t_3 )
-	{
-		GtkTreeModel *model_old = gtk_icon_view_get_model ( win->icon_view );
+	win->thumb_cancel = g_cancellable_new ();
 
-		gtk_list_store_clear ( GTK_LIST_STORE ( model_old ) );
+	win->thumb_serial++;
+	win->thumb_left = 0;
+	win->thumb_rows = 0;
 
-		gtk_icon_view_set_model ( win->icon_view, win->model_t );
+	free ( win->thumb_state );
+	win->thumb_state = NULL;
 
-		g_object_unref ( win->model_t );
-		win->model_t = NULL;
+	icon_thumb_free_list ( win->thumb_pending );
+	win->thumb_pending = NULL;
+	win->thumb_done = 0;
 
-		return FALSE;
-	}
+	if ( win->tick_thumb ) gtk_widget_remove_tick_callback ( GTK_WIDGET ( win->icon_view ), win->tick_thumb );
+	if ( win->src_rank   ) g_source_remove ( win->src_rank );
 
-	return TRUE;
+	win->tick_thumb = 0;
+	win->src_rank   = 0;
 }
 
-static void icon_update_pixbuf_all ( uint nums, ImageWin *win )
+static void icon_model_set_iter ( const char *path, const char *key, GFileInfo *finfo, gboolean is_pbf, GdkPixbuf *pixbuf, GtkTreeModel *model )
 {
-	win->break_t = FALSE;
-
-	win->mod_t = 0; win->limit_t = 0; win->done_t_0 = FALSE; win->end_t = nums / 2;
-	GThread *thread_0_0 = g_thread_new ( NULL, (GThreadFunc)icon_update_pixbuf_thread, win );
+	gtk_list_store_insert_with_values ( GTK_LIST_STORE ( model ), NULL, -1,
+		COL_PATH, path,
+		COL_NAME, g_file_info_get_display_name ( finfo ),
+		COL_IS_DIR, ( g_file_info_get_file_type ( finfo ) == G_FILE_TYPE_DIRECTORY ),
+		COL_IS_LINK, g_file_info_get_is_symlink ( finfo ),
+		COL_IS_PIXBUF, is_pbf,
+		COL_PIXBUF, pixbuf,
+		COL_KEY, key,
+		COL_CONTENT_TYPE, g_intern_string ( g_file_info_get_attribute_string ( finfo, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE ) ),
+		COL_ICON, g_file_info_get_icon ( finfo ),
+		COL_MTIME, (int64_t)g_file_info_get_attribute_uint64 ( finfo, G_FILE_ATTRIBUTE_TIME_MODIFIED ),
+		COL_SIZE, g_file_info_get_size ( finfo ),
+		-1 );
+}
 
-	g_usleep ( 20000 );
-	win->mod_t = 1; win->limit_t = 0; win->done_t_1 = FALSE;
-	GThread *thread_1_0 = g_thread_new ( NULL, (GThreadFunc)icon_update_pixbuf_thread, win );
+static void icon_model_set_sorted ( gboolean sorted, GtkTreeModel *model )
+{
+	if ( !model ) return;
 
-	g_usleep ( 20000 );
-	win->mod_t = 0; win->limit_t = 1; win->done_t_2 = FALSE;
-	GThread *thread_0_1 = g_thread_new ( NULL, (GThreadFunc)icon_update_pixbuf_thread, win );
+	gtk_tree_sortable_set_sort_column_id ( GTK_TREE_SORTABLE ( model ), ( sorted ) ? GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID : GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING );
+}
 
-	g_usleep ( 20000 );
-	win->mod_t = 1; win->limit_t = 1; win->done_t_3 = FALSE;
-	GThread *thread_1_1 = g_thread_new ( NULL, (GThreadFunc)icon_update_pixbuf_thread, win );
+/* Everything the icon view and the thumbnail workers need, in one pass; the fast content type never sniffs file data */
+#define ENUM_ATTRS G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+	G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK "," G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE "," G_FILE_ATTRIBUTE_STANDARD_ICON "," \
+	G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED
 
-	g_thread_unref ( thread_0_0 );
-	g_thread_unref ( thread_1_0 );
-	g_thread_unref ( thread_0_1 );
-	g_thread_unref ( thread_1_1 );
+#define ENUM_CHUNK 256
 
-	g_timeout_add ( 50, (GSourceFunc)icon_update_pixbuf_timeout, win );
-}
+typedef struct _IconEnum IconEnum;
 
-static uint16_t icon_get_vis_items ( ImageWin *win )
+struct _IconEnum
 {
-	int w = gtk_widget_get_allocated_width  ( GTK_WIDGET ( win->icon_view ) );
-	int h = gtk_widget_get_allocated_height ( GTK_WIDGET ( win->icon_view ) );
+	ImageWin *win;
 
-	int item_col_s = gtk_icon_view_get_column_spacing ( win->icon_view );
-	int item_width = gtk_icon_view_get_item_width ( win->icon_view );
+	char *path_dir;
+	GFileEnumerator *enumerator;
+	GCancellable *cancel;
 
-	uint16_t ch = (uint16_t)( h / ( item_width - 20 ) );
-	uint16_t cw = (uint16_t)( w / ( item_width + item_col_s ) );
+	GdkPixbuf *pb_wait;
+	GdkPixbuf *pb_dir;
+	GdkPixbuf *pb_file;
 
-	uint16_t items = (uint16_t)( cw * ch );
+	uint nums;
+};
 
-	items *= 2;
+static void icon_enum_free ( IconEnum *ie )
+{
+	if ( ie->enumerator ) g_object_unref ( ie->enumerator );
 
-	return items;
-}
+	if ( ie->pb_wait ) g_object_unref ( ie->pb_wait );
+	if ( ie->pb_dir  ) g_object_unref ( ie->pb_dir  );
+	if ( ie->pb_file ) g_object_unref ( ie->pb_file );
 
-static void icon_model_set_iter ( const char *path, const char *name, gboolean is_dir, gboolean is_slk, gboolean is_pbf, GdkPixbuf *pixbuf, GtkTreeModel *model )
-{
-	GtkTreeIter iter;
-	gtk_list_store_append ( GTK_LIST_STORE ( model ), &iter );
+	g_object_unref ( ie->cancel );
 
-	gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter,
-		COL_PATH, path,
-		COL_NAME, name,
-		COL_IS_DIR, is_dir,
-		COL_IS_LINK, is_slk,
-		COL_IS_PIXBUF, is_pbf,
-		COL_PIXBUF, pixbuf,
-		-1 );
+	free ( ie->path_dir );
+	free ( ie );
 }
 
-static int icon_sort_func_list ( gconstpointer a, gconstpointer b )
+static void icon_enum_add ( GFileInfo *finfo, GtkTreeModel *model, IconEnum *ie )
 {
-	int ret = 1;
+	ImageWin *win = ie->win;
 
-	gboolean is_dir_a = g_file_test ( a, G_FILE_TEST_IS_DIR );
-	gboolean is_dir_b = g_file_test ( b, G_FILE_TEST_IS_DIR );
-	
-	if ( !is_dir_a && is_dir_b )
-		ret = 1;
-	else if ( is_dir_a && !is_dir_b )
-		ret = -1;
-	else
+	const char *name = g_file_info_get_name ( finfo );
+
+	if ( !name || name[0] == '.' ) return;
+
+	g_autofree char *path = g_build_filename ( ie->path_dir, name, NULL );
+
+	const char *display_name = g_file_info_get_display_name ( finfo );
+
+	g_autofree char *key = g_utf8_collate_key_for_filename ( display_name, -1 );
+
+	gboolean is_dir = ( g_file_info_get_file_type ( finfo ) == G_FILE_TYPE_DIRECTORY );
+	gboolean is_slk = g_file_info_get_is_symlink ( finfo );
+
+	const char *content_type = g_file_info_get_attribute_string ( finfo, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE );
+
+	if ( win->preview && !icon_is_image ( content_type ) )
 	{
-		g_autofree char *na = g_utf8_collate_key_for_filename ( a, -1 );
-		g_autofree char *nb = g_utf8_collate_key_for_filename ( b, -1 );
+		GdkPixbuf *pixbuf = icon_get_icon_pixbuf ( g_file_info_get_icon ( finfo ), content_type, is_dir, is_slk, win->icon_size );
+
+		icon_model_set_iter ( path, g_string_chunk_insert ( win->keys, key ), finfo, TRUE, pixbuf, model );
 
-		ret = g_strcmp0 ( na, nb );
+		if ( pixbuf ) g_object_unref ( pixbuf );
 	}
+	else
+		icon_model_set_iter ( path, g_string_chunk_insert ( win->keys, key ), finfo, !win->preview, ( win->preview ) ? ie->pb_wait : ( is_dir ) ? ie->pb_dir : ie->pb_file, model );
 
-	return ret;
+	ie->nums++;
 }
 
-static void icon_open_dir ( const char *path_dir, ImageWin *win )
+static void icon_enum_done ( IconEnum *ie )
 {
-	g_return_if_fail ( path_dir != NULL );
+	ImageWin *win = ie->win;
 
-	GDir *dir = g_dir_open ( path_dir, 0, NULL );
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
 
-	if ( !dir ) { dialog_message ( "", g_strerror ( errno ), GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) ); return; }
+	icon_model_set_sorted ( TRUE, model );
 
-	GList *list = NULL;
-	const char *name = NULL;
+	if ( win->preview && ie->nums )
+	{
+		win->thumb_rows  = ie->nums;
+		win->thumb_state = g_malloc0 ( ie->nums );
 
-	while ( ( name = g_dir_read_name (dir) ) ) list = g_list_append ( list, g_build_filename ( path_dir, name, NULL ) );
+		GtkTreeIter iter;
+		gboolean valid = FALSE;
 
-	g_dir_close ( dir );
+		uint c = 0; for ( valid = gtk_tree_model_get_iter_first ( model, &iter ); valid; valid = gtk_tree_model_iter_next ( model, &iter ), c++ )
+		{
+			gboolean is_pb = FALSE;
+			gtk_tree_model_get ( model, &iter, COL_IS_PIXBUF, &is_pb, -1 );
 
-	GList *list_sort = g_list_sort ( list, icon_sort_func_list );
+			if ( is_pb ) { win->thumb_state[c] = THUMB_DONE; win->thumb_done++; }
+		}
 
-	win->model_t = ( win->preview ) ? icon_create_model () : NULL;
+		icon_thumb_progress ( win );
 
-	uint nums = 0;
-	uint16_t items = icon_get_vis_items ( win );
-	GtkIconTheme *itheme = gtk_icon_theme_get_default ();
-	GtkTreeModel *model  = gtk_icon_view_get_model ( win->icon_view );
+		win->src_rank = g_timeout_add ( 50, (GSourceFunc)icon_thumb_rank, win );
+	}
 
-	gtk_list_store_clear ( GTK_LIST_STORE ( model ) );
+	GtkTreePath *tree_path = gtk_tree_path_new_first ();
 
-	while ( list_sort != NULL )
-	{
-		char *path = (char *)list_sort->data;
-		char *name = g_path_get_basename ( path );
-		char *display_name = g_filename_to_utf8 ( name, -1, NULL, NULL, NULL );
+	gtk_icon_view_scroll_to_path ( win->icon_view, tree_path, FALSE, 0, 0 );
 
-		if ( name[0] != '.' )
-		{
-			gboolean is_dir = g_file_test ( path, G_FILE_TEST_IS_DIR );
-			gboolean is_slk = g_file_test ( path, G_FILE_TEST_IS_SYMLINK );
+	gtk_tree_path_free ( tree_path );
 
-			if ( win->preview )
-			{
-				if ( nums < items )
-				{
-					GdkPixbuf *pixbuf = icon_get_pixbuf ( path, is_slk, win->icon_size );
+	g_debug ( "%s:: %u entries :: %s", __func__, ie->nums, ie->path_dir );
 
-					icon_model_set_iter ( path, display_name, is_dir, is_slk, TRUE, pixbuf, model );
-					icon_model_set_iter ( path, display_name, is_dir, is_slk, TRUE, pixbuf, win->model_t );
+	image_icon_stats_dump ();
+}
 
-					if ( pixbuf ) g_object_unref ( pixbuf );
-				}
-				else
-					icon_model_set_iter ( path, display_name, is_dir, is_slk, FALSE, NULL, win->model_t );
-			}
-			else
-			{
-				GdkPixbuf *pixbuf = gtk_icon_theme_load_icon ( itheme, ( is_dir ) ? "folder" : "text-x-preview", win->icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR, NULL );
+/* Chunks are appended as they arrive with sorting off; the model is sorted once at the end */
+static void icon_enum_next ( GFileEnumerator *enumerator, GAsyncResult *res, IconEnum *ie )
+{
+	GError *error = NULL;
+	GList *list = g_file_enumerator_next_files_finish ( enumerator, res, &error );
 
-				icon_model_set_iter ( path, display_name, is_dir, is_slk, TRUE, pixbuf, model );
+	if ( error )
+	{
+		if ( !g_error_matches ( error, G_IO_ERROR, G_IO_ERROR_CANCELLED ) ) { g_warning ( "%s:: %s ", __func__, error->message ); icon_enum_done ( ie ); }
 
-				if ( pixbuf ) g_object_unref ( pixbuf );
-			}
+		g_error_free ( error );
+		icon_enum_free ( ie );
 
-			nums++;
-		}
+		return;
+	}
 
-		free ( name );
-		free ( display_name );
+	if ( !list ) { icon_enum_done ( ie ); icon_enum_free ( ie ); return; }
 
-		list_sort = list_sort->next;
-	}
+	GtkTreeModel *model = gtk_icon_view_get_model ( ie->win->icon_view );
 
-	g_list_free_full ( list, (GDestroyNotify) free );
+	GList *l = NULL; for ( l = list; l; l = l->next ) icon_enum_add ( G_FILE_INFO ( l->data ), model, ie );
 
-	if ( win->preview && nums >= items ) icon_update_pixbuf_all ( nums, win ); else { if ( win->model_t ) g_object_unref ( win->model_t ); win->model_t = NULL; }
+	g_list_free_full ( list, g_object_unref );
 
-	gtk_icon_view_scroll_to_path ( win->icon_view, gtk_tree_path_new_first (), FALSE, 0, 0 );
+	g_file_enumerator_next_files_async ( enumerator, ENUM_CHUNK, G_PRIORITY_DEFAULT, ie->cancel, (GAsyncReadyCallback)icon_enum_next, ie );
 }
 
-static gboolean icon_open_dir_timeout ( ImageWin *win )
+static void icon_enum_ready ( GFile *dir, GAsyncResult *res, IconEnum *ie )
 {
-	if ( !GTK_IS_WIDGET ( win->icon_view ) ) return FALSE;
+	GError *error = NULL;
+	ie->enumerator = g_file_enumerate_children_finish ( dir, res, &error );
 
-	if ( win->model_t == NULL )
+	if ( error )
 	{
-		g_autofree char *path = g_file_get_path ( win->dir );
+		if ( !g_error_matches ( error, G_IO_ERROR, G_IO_ERROR_CANCELLED ) ) dialog_message ( "", error->message, GTK_MESSAGE_WARNING, GTK_WINDOW ( ie->win ) );
 
-		if ( path ) icon_open_dir ( path, win );
+		g_error_free ( error );
+		icon_enum_free ( ie );
 
-		return FALSE;
+		return;
 	}
 
-	return TRUE;
+	g_file_enumerator_next_files_async ( ie->enumerator, ENUM_CHUNK, G_PRIORITY_DEFAULT, ie->cancel, (GAsyncReadyCallback)icon_enum_next, ie );
 }
 
-static void icon_open_dir_tm ( ImageWin *win )
+static void icon_open_dir ( ImageWin *win )
 {
-	win->break_t = TRUE;
+	g_return_if_fail ( win->dir != NULL );
+
+	g_cancellable_cancel ( win->enum_cancel );
+	g_object_unref ( win->enum_cancel );
 
-	g_timeout_add ( 80, (GSourceFunc)icon_open_dir_timeout, win );
+	win->enum_cancel = g_cancellable_new ();
+
+	icon_thumb_cancel ( win );
+
+	GtkTreeModel *model = gtk_icon_view_get_model ( win->icon_view );
+
+	gtk_list_store_clear ( GTK_LIST_STORE ( model ) );
+	g_string_chunk_clear ( win->keys );
+
+	icon_model_set_sorted ( FALSE, model );
+
+	IconEnum *ie = g_new0 ( IconEnum, 1 );
+
+	ie->win = win;
+	ie->path_dir = g_file_get_path ( win->dir );
+	ie->cancel = g_object_ref ( win->enum_cancel );
+
+	if ( win->preview )
+	{
+		ie->pb_wait = image_icon_get_name ( "image-loading", win->icon_size, GTK_ICON_LOOKUP_FORCE_SIZE );
+
+		if ( !ie->pb_wait ) ie->pb_wait = image_icon_get_name ( "image-x-generic", win->icon_size, GTK_ICON_LOOKUP_FORCE_SIZE );
+	}
+	else
+	{
+		ie->pb_dir  = image_icon_get_name ( "folder", win->icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR );
+		ie->pb_file = image_icon_get_name ( "text-x-preview", win->icon_size, GTK_ICON_LOOKUP_FORCE_REGULAR );
+	}
+
+	image_load_stats_dump ( "previous", 0 );
+	image_cache_stats_dump ( win->cache );
+
+	g_file_enumerate_children_async ( win->dir, ENUM_ATTRS, G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT, ie->cancel, (GAsyncReadyCallback)icon_enum_ready, ie );
 }
 
 static void icon_set_dir ( GFile *file, ImageWin *win )
@@ -1283,7 +1780,9 @@ static void icon_set_dir ( GFile *file, ImageWin *win )
 
 	gtk_label_set_text ( win->bar_label, " " );
 
-	icon_open_dir_tm ( win );
+	image_prefetch_cancel ( win->prefetch );
+
+	icon_open_dir ( win );
 }
 
 static void icon_item_activated ( GtkIconView *icon_view, GtkTreePath *tree_path, ImageWin *win )
@@ -1346,6 +1845,19 @@ static void image_win_signal_drop ( UNUSED GtkWindow *window, GdkDragContext *ct
 
 static void image_win_destroy ( UNUSED GtkWindow *window, ImageWin *win )
 {
+	g_cancellable_cancel ( win->enum_cancel );
+
+	icon_thumb_cancel ( win );
+
+	if ( win->src_fit ) g_source_remove ( win->src_fit );
+
+	win->src_fit = 0;
+
+	image_stream_cancel ( win->stream );
+	image_win_sharp_cancel ( win );
+	image_anim_stop ( win->anim );
+	image_slide_stop ( win->slide );
+
 	gtk_icon_view_unselect_all ( win->icon_view );
 }
 
@@ -1364,17 +1876,17 @@ static void image_win_create ( ImageWin *win )
 	GtkBox *main_vbox = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_VERTICAL,   0 );
 	gtk_widget_set_visible ( GTK_WIDGET ( main_vbox ), TRUE );
 
-	gtk_widget_set_events ( GTK_WIDGET ( window ), GDK_SCROLL_MASK |  GDK_STRUCTURE_MASK );
+	gtk_widget_set_events ( GTK_WIDGET ( window ), GDK_SCROLL_MASK );
 	g_signal_connect ( window, "scroll-event",    G_CALLBACK ( image_win_scroll_event ), win );
-	g_signal_connect ( window, "configure-event", G_CALLBACK ( image_win_config_event ), win );
 
 	win->swin_img = (GtkScrolledWindow *)gtk_scrolled_window_new ( NULL, NULL );
 	gtk_scrolled_window_set_policy ( win->swin_img, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC );
 
-	gtk_widget_set_events ( GTK_WIDGET ( win->swin_img ), GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK | GDK_KEY_PRESS_MASK );
+	gtk_widget_set_events ( GTK_WIDGET ( win->swin_img ), GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK | GDK_KEY_PRESS_MASK | GDK_SCROLL_MASK );
 	g_signal_connect ( win->swin_img, "button-press-event",   G_CALLBACK ( image_win_press_event   ), win );
 	g_signal_connect ( win->swin_img, "button-release-event", G_CALLBACK ( image_win_release_event ), win );
 	g_signal_connect ( win->swin_img, "motion-notify-event",  G_CALLBACK ( image_win_notify_event  ), win );
+	g_signal_connect ( win->swin_img, "scroll-event",         G_CALLBACK ( image_win_zoom_scroll_event ), win );
 
 	win->bar_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
 
@@ -1388,10 +1900,14 @@ static void image_win_create ( ImageWin *win )
 	win->adjv = gtk_scrolled_window_get_vadjustment ( win->swin_img );
 	win->adjh = gtk_scrolled_window_get_hadjustment ( win->swin_img );
 
-	win->image = (GtkImage *)gtk_image_new ();
-	gtk_widget_set_visible ( GTK_WIDGET ( win->image ), TRUE );
+	win->view = g_object_ref_sink ( image_view_new () );
+	gtk_widget_set_visible ( GTK_WIDGET ( win->view ), TRUE );
+	g_signal_connect_after ( win->view, "size-allocate", G_CALLBACK ( image_win_view_allocate ), win );
+
+	gtk_container_add ( GTK_CONTAINER ( win->swin_img ), GTK_WIDGET ( win->view ) );
 
-	gtk_container_add ( GTK_CONTAINER ( win->swin_img ), GTK_WIDGET ( win->image ) );
+	win->anim = image_anim_new ( win->view, (AnimFunc)image_win_anim, win );
+	win->slide = image_slide_new ( GTK_WIDGET ( win->view ), (SlideFunc)image_win_slide_next, (SlideFunc)image_win_slide_ready, win );
 
 	gtk_widget_set_visible ( GTK_WIDGET ( win->swin_img ), FALSE );
 	gtk_box_pack_start ( main_vbox, GTK_WIDGET ( win->swin_img ), TRUE, TRUE, 0 );
@@ -1405,6 +1921,10 @@ static void image_win_create ( ImageWin *win )
 
 	gtk_container_add ( GTK_CONTAINER ( win->swin_prw ), GTK_WIDGET ( win->icon_view ) );
 
+	GtkAdjustment *adj_prw = gtk_scrolled_window_get_vadjustment ( win->swin_prw );
+	g_signal_connect ( adj_prw, "value-changed", G_CALLBACK ( icon_thumb_scroll ), win );
+	g_signal_connect ( adj_prw, "changed",       G_CALLBACK ( icon_thumb_scroll ), win );
+
 	gtk_widget_set_visible ( GTK_WIDGET ( win->swin_prw ), FALSE );
 	gtk_box_pack_start ( main_vbox, GTK_WIDGET ( win->swin_prw ), TRUE, TRUE, 0 );
 
@@ -1417,20 +1937,54 @@ static void image_win_init ( ImageWin *win )
 {
 	win->file = NULL;
 
-	win->config   = TRUE;
 	win->original = FALSE;
+	win->tiled    = FALSE;
+	win->vector   = FALSE;
+
+	win->source   = NULL;
+
+	win->orient = 1;
 
-	win->pb_type_lr = POR;
-	win->pb_type_hv = POR;
+	win->timeout  = 5000;
+	win->src_fit  = 0;
 
-	win->timeout  = 5;
-	win->src_play = 0;
+	win->index = image_index_new ();
+	win->prefetch = image_prefetch_new ( PREFETCH_DEPTH, PREFETCH_BYTES );
+	win->stream = image_stream_new ( TRUE, (StreamFunc)image_win_stream, win );
+
+	win->streaming    = FALSE;
+	win->stream_shown = FALSE;
+
+	win->stream_prev = NULL;
+	win->stream_back = FALSE;
+	win->stream_prw  = FALSE;
+
+	win->sharp = image_stream_new ( FALSE, (StreamFunc)image_win_sharp, win );
+	win->sharp_w = 0;
+	win->sharp_h = 0;
+	win->sharp_fit = FALSE;
+
+	win->animated = FALSE;
 
 	win->cursor = gdk_cursor_new_for_display ( gdk_display_get_default (), GDK_FLEUR );
 
 	win->dir = NULL;
 
-	win->model_t = NULL;
+	win->keys = g_string_chunk_new ( 4096 );
+	win->enum_cancel = g_cancellable_new ();
+
+	win->tick_thumb = 0;
+	win->src_rank   = 0;
+
+	win->thumb_rows   = 0;
+	win->thumb_done   = 0;
+	win->thumb_pending = NULL;
+	win->thumb_left   = 0;
+	win->thumb_serial = 0;
+	win->thumb_state  = NULL;
+
+	win->thumb_cancel = g_cancellable_new ();
+	win->thumb_client = image_thumb_client_new ();
 
 	win->preview = TRUE;
 	win->icon_size = 48;
@@ -1443,6 +1997,28 @@ static void image_win_finalize ( GObject *object )
 	ImageWin *win = IMAGE_WIN ( object );
 
 	if ( win->dir  ) g_object_unref ( win->dir  );
+	if ( win->file ) g_object_unref ( win->file );
+	if ( win->stream_prev ) g_object_unref ( win->stream_prev );
+
+	image_stream_free ( win->stream );
+	image_stream_free ( win->sharp );
+	image_anim_free ( win->anim );
+	image_slide_free ( win->slide );
+	image_prefetch_free ( win->prefetch );
+	image_index_free ( win->index );
+
+	g_object_unref ( win->view );
+
+	if ( win->source ) g_object_unref ( win->source );
+
+	image_thumb_client_free ( win->thumb_client );
+
+	g_object_unref ( win->thumb_cancel );
+	g_object_unref ( win->enum_cancel );
+
+	free ( win->thumb_state );
+
+	g_string_chunk_free ( win->keys );
 
 	G_OBJECT_CLASS ( image_win_parent_class )->finalize ( object );
 }
@@ -1458,6 +2034,9 @@ ImageWin * image_win_new ( GFile *file, ImageApp *app )
 {
 	ImageWin *win = g_object_new ( IMAGE_TYPE_WIN, "application", app, NULL );
 
+	win->cache = image_app_get_cache ( app );
+	win->thumb_pool = image_app_get_thumb_pool ( app );
+
 	image_win_arg ( file, win );
 
 	return win;
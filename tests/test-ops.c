@@ -0,0 +1,272 @@
+/*
+* Copyright 2023 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-3
+* file:///usr/share/common-licenses/GPL-3
+* http://www.gnu.org/licenses/gpl-3.0.html
+*/
+
+#include "image-ops.c"
+
+/*
+* IMAGE_OPS_CPU caps the dispatch ( meson runs every level ); whatever rows it picks
+* have to match the scalar rows byte for byte. Orientation is checked against
+* the plain pixel mapping as well, so the scalar run tests the scalar code too.
+*/
+
+static OpsFuncs ops_cpu;
+
+static const OpsFuncs ops_scalar = { OPS_CPU_SCALAR, image_ops_row_h_scalar, image_ops_row_v_scalar, image_ops_row_rgb_scalar };
+
+static uint32_t test_seed = 2463534242u;
+
+static uint8_t test_rand ( void )
+{
+	test_seed ^= test_seed << 13;
+	test_seed ^= test_seed >> 17;
+	test_seed ^= test_seed << 5;
+
+	return (uint8_t)( test_seed >> 24 );
+}
+
+static GdkPixbuf * test_pixbuf ( int w, int h, gboolean alpha )
+{
+	GdkPixbuf *pixbuf = gdk_pixbuf_new ( GDK_COLORSPACE_RGB, alpha, 8, w, h );
+
+	int stride = gdk_pixbuf_get_rowstride ( pixbuf );
+	uint8_t *pixels = gdk_pixbuf_get_pixels ( pixbuf );
+
+	int c = 0; for ( c = 0; c < stride * ( h - 1 ) + w * gdk_pixbuf_get_n_channels ( pixbuf ); c++ ) pixels[c] = test_rand ();
+
+	return pixbuf;
+}
+
+static void test_assert_equal ( GdkPixbuf *a, GdkPixbuf *b )
+{
+	g_assert_nonnull ( a );
+	g_assert_nonnull ( b );
+
+	int w = gdk_pixbuf_get_width ( a ), h = gdk_pixbuf_get_height ( a ), n = gdk_pixbuf_get_n_channels ( a );
+
+	g_assert_cmpint ( w, ==, gdk_pixbuf_get_width  ( b ) );
+	g_assert_cmpint ( h, ==, gdk_pixbuf_get_height ( b ) );
+	g_assert_cmpint ( n, ==, gdk_pixbuf_get_n_channels ( b ) );
+
+	int sa = gdk_pixbuf_get_rowstride ( a ), sb = gdk_pixbuf_get_rowstride ( b );
+	const uint8_t *pa = gdk_pixbuf_get_pixels ( a ), *pb = gdk_pixbuf_get_pixels ( b );
+
+	int y = 0; for ( y = 0; y < h; y++ ) g_assert_cmpmem ( pa + (size_t)y * (size_t)sa, w * n, pb + (size_t)y * (size_t)sb, w * n );
+}
+
+/* Odd sizes and sizes off the vector widths, down and up, one large enough to be split into bands */
+static const int test_sizes_n[][4] =
+{
+	{    5,    3,    2,    7 },
+	{    3,    1,    1,    1 },
+	{   37,   41,  100,   90 },
+	{  640,  480,  641,  479 },
+	{ 1001,  703,  333,  211 },
+	{ 1023,  767,  513,  385 },
+	{ 2999, 2001, 1001,  667 }
+};
+
+static void test_scale ( void )
+{
+	enum ops_filter_enm filter = OPS_BOX; for ( filter = OPS_BOX; filter <= OPS_LANCZOS; filter++ )
+	{
+		gboolean alpha = FALSE; for ( alpha = FALSE; alpha <= TRUE; alpha++ )
+		{
+			uint c = 0; for ( c = 0; c < G_N_ELEMENTS ( test_sizes_n ); c++ )
+			{
+				GdkPixbuf *pixbuf = test_pixbuf ( test_sizes_n[c][0], test_sizes_n[c][1], alpha );
+
+				ops = ops_cpu;
+				GdkPixbuf *pb_cpu = image_ops_scale ( pixbuf, test_sizes_n[c][2], test_sizes_n[c][3], filter );
+
+				ops = ops_scalar;
+				GdkPixbuf *pb_ref = image_ops_scale ( pixbuf, test_sizes_n[c][2], test_sizes_n[c][3], filter );
+
+				test_assert_equal ( pb_cpu, pb_ref );
+
+				g_object_unref ( pb_cpu );
+				g_object_unref ( pb_ref );
+				g_object_unref ( pixbuf );
+			}
+		}
+	}
+
+	ops = ops_cpu;
+}
+
+/* The source pixel of ( dx, dy ) in the oriented image, from the EXIF definitions */
+static void test_orient_src ( uint8_t orient, int w, int h, int dx, int dy, int *sx, int *sy )
+{
+	switch ( orient )
+	{
+		case 2:  *sx = w - 1 - dx; *sy = dy; break;
+		case 3:  *sx = w - 1 - dx; *sy = h - 1 - dy; break;
+		case 4:  *sx = dx; *sy = h - 1 - dy; break;
+		case 5:  *sx = dy; *sy = dx; break;
+		case 6:  *sx = dy; *sy = h - 1 - dx; break;
+		case 7:  *sx = w - 1 - dy; *sy = h - 1 - dx; break;
+		case 8:  *sx = w - 1 - dy; *sy = dx; break;
+		default: *sx = dx; *sy = dy; break;
+	}
+}
+
+static void test_orient_check ( GdkPixbuf *pixbuf, GdkPixbuf *pb_dst, uint8_t orient )
+{
+	int w = gdk_pixbuf_get_width ( pixbuf ), h = gdk_pixbuf_get_height ( pixbuf ), n = gdk_pixbuf_get_n_channels ( pixbuf );
+
+	g_assert_cmpint ( gdk_pixbuf_get_width  ( pb_dst ), ==, ( orient >= 5 ) ? h : w );
+	g_assert_cmpint ( gdk_pixbuf_get_height ( pb_dst ), ==, ( orient >= 5 ) ? w : h );
+
+	int ss = gdk_pixbuf_get_rowstride ( pixbuf ), ds = gdk_pixbuf_get_rowstride ( pb_dst );
+	const uint8_t *sp = gdk_pixbuf_get_pixels ( pixbuf ), *dp = gdk_pixbuf_get_pixels ( pb_dst );
+
+	int dy = 0; for ( dy = 0; dy < gdk_pixbuf_get_height ( pb_dst ); dy++ )
+	{
+		int dx = 0; for ( dx = 0; dx < gdk_pixbuf_get_width ( pb_dst ); dx++ )
+		{
+			int sx = 0, sy = 0;
+			test_orient_src ( orient, w, h, dx, dy, &sx, &sy );
+
+			g_assert_cmpmem ( dp + (size_t)dy * (size_t)ds + (size_t)dx * (size_t)n, n, sp + (size_t)sy * (size_t)ss + (size_t)sx * (size_t)n, n );
+		}
+	}
+}
+
+/* Odd and one-pixel sides, partial 4x4 blocks at the edges, more than one OPS_BLOCK */
+static const int test_orient_sizes_n[][2] = { { 1, 9 }, { 9, 1 }, { 67, 5 }, { 131, 77 }, { 259, 130 } };
+
+static void test_orient ( void )
+{
+	gboolean alpha = FALSE; for ( alpha = FALSE; alpha <= TRUE; alpha++ )
+	{
+		uint c = 0; for ( c = 0; c < G_N_ELEMENTS ( test_orient_sizes_n ); c++ )
+		{
+			GdkPixbuf *pixbuf = test_pixbuf ( test_orient_sizes_n[c][0], test_orient_sizes_n[c][1], alpha );
+
+			uint8_t orient = 2; for ( orient = 2; orient <= 8; orient++ )
+			{
+				ops = ops_cpu;
+				GdkPixbuf *pb_cpu = image_ops_orient ( pixbuf, orient );
+
+				ops = ops_scalar;
+				GdkPixbuf *pb_ref = image_ops_orient ( pixbuf, orient );
+
+				test_orient_check ( pixbuf, pb_cpu, orient );
+				test_assert_equal ( pb_cpu, pb_ref );
+
+				g_object_unref ( pb_cpu );
+				g_object_unref ( pb_ref );
+			}
+
+			g_object_unref ( pixbuf );
+		}
+	}
+
+	ops = ops_cpu;
+}
+
+/* a, then b, is the single orientation compose returns */
+static void test_orient_compose ( void )
+{
+	GdkPixbuf *pixbuf = test_pixbuf ( 13, 7, TRUE );
+
+	uint8_t a = 1; for ( a = 1; a <= 8; a++ )
+	{
+		uint8_t b = 1; for ( b = 1; b <= 8; b++ )
+		{
+			GdkPixbuf *pb_a  = image_ops_orient ( pixbuf, a );
+			GdkPixbuf *pb_ab = image_ops_orient ( pb_a, b );
+			GdkPixbuf *pb_c  = image_ops_orient ( pixbuf, image_ops_orient_compose ( a, b ) );
+
+			test_assert_equal ( pb_ab, pb_c );
+
+			g_object_unref ( pb_a );
+			g_object_unref ( pb_ab );
+			g_object_unref ( pb_c );
+		}
+	}
+
+	g_object_unref ( pixbuf );
+}
+
+static void test_argb32_rect ( GdkPixbuf *pixbuf, int x, int y, int w, int h )
+{
+	int stride = w * 4;
+
+	uint8_t *dst_cpu = g_malloc0 ( (size_t)stride * (size_t)h );
+	uint8_t *dst_ref = g_malloc0 ( (size_t)stride * (size_t)h );
+
+	ops = ops_cpu;
+	image_ops_to_argb32 ( pixbuf, x, y, w, h, dst_cpu, stride );
+
+	ops = ops_scalar;
+	image_ops_to_argb32 ( pixbuf, x, y, w, h, dst_ref, stride );
+
+	g_assert_cmpmem ( dst_cpu, stride * h, dst_ref, stride * h );
+
+	/* Opaque RGB needs no premultiply: each pixel is exact */
+	if ( !gdk_pixbuf_get_has_alpha ( pixbuf ) )
+	{
+		int ps = gdk_pixbuf_get_rowstride ( pixbuf );
+		const uint8_t *pixels = gdk_pixbuf_get_pixels ( pixbuf );
+
+		int r = 0; for ( r = 0; r < h; r++ )
+		{
+			int c = 0; for ( c = 0; c < w; c++ )
+			{
+				const uint8_t *s = pixels + (size_t)( y + r ) * (size_t)ps + (size_t)( x + c ) * 3;
+				uint32_t argb = ( (uint32_t *)( dst_cpu + (size_t)r * (size_t)stride ) )[c];
+
+				g_assert_cmphex ( argb, ==, 0xff000000u | (uint32_t)s[0] << 16 | (uint32_t)s[1] << 8 | s[2] );
+			}
+		}
+	}
+
+	free ( dst_cpu );
+	free ( dst_ref );
+}
+
+static void test_argb32 ( void )
+{
+	gboolean alpha = FALSE; for ( alpha = FALSE; alpha <= TRUE; alpha++ )
+	{
+		GdkPixbuf *pixbuf = test_pixbuf ( 301, 7, alpha );
+
+		test_argb32_rect ( pixbuf, 0, 0, 301, 7 );
+		test_argb32_rect ( pixbuf, 3, 2, 250, 4 );
+		test_argb32_rect ( pixbuf, 300, 6, 1, 1 );
+
+		g_object_unref ( pixbuf );
+
+		pixbuf = test_pixbuf ( 1537, 1031, alpha );
+
+		test_argb32_rect ( pixbuf, 0, 0, 1537, 1031 );
+
+		g_object_unref ( pixbuf );
+	}
+
+	ops = ops_cpu;
+}
+
+int main ( int argc, char *argv[] )
+{
+	g_test_init ( &argc, &argv, NULL );
+
+	image_ops_init ();
+
+	ops_cpu = ops;
+
+	g_test_message ( "cpu: %s", image_ops_get_cpu () );
+
+	g_test_add_func ( "/ops/scale", test_scale );
+	g_test_add_func ( "/ops/orient", test_orient );
+	g_test_add_func ( "/ops/orient-compose", test_orient_compose );
+	g_test_add_func ( "/ops/argb32", test_argb32 );
+
+	return g_test_run ();
+}